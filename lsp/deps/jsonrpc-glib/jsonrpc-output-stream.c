@@ -55,6 +55,28 @@ typedef struct
   guint  processing : 1;
 } JsonrpcOutputStreamPrivate;
 
+/*
+ * Headers and bodies of all the queued messages are written to the base
+ * stream by a single writev() (when available) instead of a write per
+ * message. The body isn't copied after the header for that reason.
+ */
+#define MAX_BATCH_MESSAGES 64
+
+typedef struct
+{
+  GBytes *header;
+  GBytes *body;  /* NULL when part of header */
+} JsonrpcOutputMessage;
+
+typedef struct
+{
+  JsonrpcOutputStream *self;
+  GPtrArray           *tasks;
+  GOutputVector       *vectors;
+  gsize                n_vectors;
+  gsize                size;
+} JsonrpcOutputBatch;
+
 G_DEFINE_TYPE_WITH_PRIVATE (JsonrpcOutputStream, jsonrpc_output_stream, G_TYPE_DATA_OUTPUT_STREAM)
 
 static void jsonrpc_output_stream_write_message_async_cb (GObject      *object,
@@ -149,11 +171,20 @@ jsonrpc_output_stream_init (JsonrpcOutputStream *self)
   g_queue_init (&priv->queue);
 }
 
-static GBytes *
-jsonrpc_output_stream_create_bytes (JsonrpcOutputStream  *self,
-                                    GVariant             *message,
-                                    GError              **error)
+static void
+jsonrpc_output_message_free (JsonrpcOutputMessage *msg)
+{
+  g_clear_pointer (&msg->header, g_bytes_unref);
+  g_clear_pointer (&msg->body, g_bytes_unref);
+  g_slice_free (JsonrpcOutputMessage, msg);
+}
+
+static JsonrpcOutputMessage *
+jsonrpc_output_stream_create_message (JsonrpcOutputStream  *self,
+                                      GVariant             *message,
+                                      GError              **error)
 {
+  JsonrpcOutputMessage *msg;
   JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
   g_autoptr(GByteArray) buffer = NULL;
   g_autofree gchar *message_freeme = NULL;
@@ -165,7 +196,7 @@ jsonrpc_output_stream_create_bytes (JsonrpcOutputStream  *self,
   g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
   g_assert (message != NULL);
 
-  buffer = g_byte_array_sized_new (g_variant_get_size (message) + 128);
+  buffer = g_byte_array_sized_new (128);
 
   if G_UNLIKELY (jsonrpc_output_stream_debug)
     {
@@ -203,10 +234,22 @@ jsonrpc_output_stream_create_bytes (JsonrpcOutputStream  *self,
 
   g_byte_array_append (buffer, (const guint8 *)"\r\n", 2);
 
+  msg = g_slice_new0 (JsonrpcOutputMessage);
+
+#if GLIB_CHECK_VERSION (2, 60, 0)
+  /* Serialized message data is written after the header by writev() */
+  if (message_freeme != NULL)
+    msg->body = g_bytes_new_take (g_steal_pointer (&message_freeme), message_len);
+  else
+    msg->body = g_variant_get_data_as_bytes (message);
+#else
   /* Add serialized message data */
   g_byte_array_append (buffer, (const guint8 *)message_data, message_len);
+#endif
+
+  msg->header = g_byte_array_free_to_bytes (g_steal_pointer (&buffer));
 
-  return g_byte_array_free_to_bytes (g_steal_pointer (&buffer));
+  return msg;
 }
 
 JsonrpcOutputStream *
@@ -245,15 +288,33 @@ jsonrpc_output_stream_fail_pending (JsonrpcOutputStream *self)
   g_list_free (list);
 }
 
+static void
+jsonrpc_output_batch_free (JsonrpcOutputBatch *batch)
+{
+  g_ptr_array_unref (batch->tasks);
+  g_free (batch->vectors);
+  g_slice_free (JsonrpcOutputBatch, batch);
+}
+
+static void
+jsonrpc_output_batch_return_error (JsonrpcOutputBatch *batch,
+                                   const GError       *error)
+{
+  guint i;
+
+  for (i = 0; i < batch->tasks->len; i++)
+    g_task_return_error (g_ptr_array_index (batch->tasks, i), g_error_copy (error));
+}
+
 static void
 jsonrpc_output_stream_pump (JsonrpcOutputStream *self)
 {
   JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
-  g_autoptr(GTask) task = NULL;
-  const guint8 *data;
+  JsonrpcOutputBatch *batch;
+  GOutputStream *base_stream;
   GCancellable *cancellable;
-  GBytes *bytes;
-  gsize len;
+  GTask *task;
+  guint i, j;
 
   g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
 
@@ -263,29 +324,78 @@ jsonrpc_output_stream_pump (JsonrpcOutputStream *self)
   if (priv->processing)
     return;
 
-  task = g_queue_pop_head (&priv->queue);
-  bytes = g_task_get_task_data (task);
-  data = g_bytes_get_data (bytes, &len);
-  cancellable = g_task_get_cancellable (task);
-
   if (g_output_stream_is_closed (G_OUTPUT_STREAM (self)))
     {
+      task = g_queue_pop_head (&priv->queue);
       g_task_return_new_error (task,
                                G_IO_ERROR,
                                G_IO_ERROR_CLOSED,
                                "Stream has been closed");
+      g_object_unref (task);
+      jsonrpc_output_stream_fail_pending (self);
       return;
     }
 
+  batch = g_slice_new0 (JsonrpcOutputBatch);
+  batch->self = self;
+  batch->tasks = g_ptr_array_new_with_free_func (g_object_unref);
+
+  task = g_queue_peek_head (&priv->queue);
+  cancellable = g_task_get_cancellable (task);
+
+#if GLIB_CHECK_VERSION (2, 60, 0)
+  /* Messages sharing the cancellable of the first one are written together */
+  while ((task = g_queue_peek_head (&priv->queue)) &&
+         g_task_get_cancellable (task) == cancellable &&
+         batch->tasks->len < MAX_BATCH_MESSAGES)
+#else
+  if ((task = g_queue_peek_head (&priv->queue)))
+#endif
+    g_ptr_array_add (batch->tasks, g_queue_pop_head (&priv->queue));
+
+  batch->vectors = g_new0 (GOutputVector, batch->tasks->len * 2);
+
+  for (i = 0; i < batch->tasks->len; i++)
+    {
+      JsonrpcOutputMessage *msg = g_task_get_task_data (g_ptr_array_index (batch->tasks, i));
+      GBytes *parts[2] = { msg->header, msg->body };
+
+      for (j = 0; j < G_N_ELEMENTS (parts); j++)
+        {
+          GOutputVector *vector;
+
+          if (parts[j] == NULL || g_bytes_get_size (parts[j]) == 0)
+            continue;
+
+          vector = &batch->vectors[batch->n_vectors++];
+          vector->buffer = g_bytes_get_data (parts[j], &vector->size);
+          batch->size += vector->size;
+        }
+    }
+
   priv->processing = TRUE;
 
-  g_output_stream_write_all_async (G_OUTPUT_STREAM (self),
-                                   data,
-                                   len,
+  /* JsonrpcOutputStream doesn't buffer so the base stream can be written
+   * directly, GFilterOutputStream doesn't forward writev() */
+  base_stream = g_filter_output_stream_get_base_stream (G_FILTER_OUTPUT_STREAM (self));
+
+#if GLIB_CHECK_VERSION (2, 60, 0)
+  g_output_stream_writev_all_async (base_stream,
+                                    batch->vectors,
+                                    batch->n_vectors,
+                                    G_PRIORITY_DEFAULT,
+                                    cancellable,
+                                    jsonrpc_output_stream_write_message_async_cb,
+                                    batch);
+#else
+  g_output_stream_write_all_async (base_stream,
+                                   batch->vectors[0].buffer,
+                                   batch->vectors[0].size,
                                    G_PRIORITY_DEFAULT,
                                    cancellable,
                                    jsonrpc_output_stream_write_message_async_cb,
-                                   g_steal_pointer (&task));
+                                   batch);
+#endif
 }
 
 static void
@@ -293,39 +403,46 @@ jsonrpc_output_stream_write_message_async_cb (GObject      *object,
                                               GAsyncResult *result,
                                               gpointer      user_data)
 {
-  JsonrpcOutputStream *self = (JsonrpcOutputStream *)object;
+  GOutputStream *base_stream = (GOutputStream *)object;
+  JsonrpcOutputBatch *batch = user_data;
+  g_autoptr(JsonrpcOutputStream) self = g_object_ref (batch->self);
   JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
   g_autoptr(GError) error = NULL;
-  g_autoptr(GTask) task = user_data;
-  GBytes *bytes;
-  gsize n_written;
+  gsize n_written = 0;
+  gboolean ret;
+  guint i;
 
-  g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
+  g_assert (G_IS_OUTPUT_STREAM (base_stream));
   g_assert (G_IS_ASYNC_RESULT (result));
-  g_assert (G_IS_TASK (task));
+  g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
 
   priv->processing = FALSE;
 
-  if (!g_output_stream_write_all_finish (G_OUTPUT_STREAM (self), result, &n_written, &error))
+#if GLIB_CHECK_VERSION (2, 60, 0)
+  ret = g_output_stream_writev_all_finish (base_stream, result, &n_written, &error);
+#else
+  ret = g_output_stream_write_all_finish (base_stream, result, &n_written, &error);
+#endif
+
+  if (ret && batch->size != n_written)
     {
-      g_task_return_error (task, g_steal_pointer (&error));
-      jsonrpc_output_stream_fail_pending (self);
-      return;
+      ret = FALSE;
+      error = g_error_new_literal (G_IO_ERROR,
+                                   G_IO_ERROR_CLOSED,
+                                   "Failed to write all bytes to peer");
     }
 
-  bytes = g_task_get_task_data (task);
-
-  if (g_bytes_get_size (bytes) != n_written)
+  if (!ret)
     {
-      g_task_return_new_error (task,
-                               G_IO_ERROR,
-                               G_IO_ERROR_CLOSED,
-                               "Failed to write all bytes to peer");
+      jsonrpc_output_batch_return_error (batch, error);
+      jsonrpc_output_batch_free (batch);
       jsonrpc_output_stream_fail_pending (self);
       return;
     }
 
-  g_task_return_boolean (task, TRUE);
+  for (i = 0; i < batch->tasks->len; i++)
+    g_task_return_boolean (g_ptr_array_index (batch->tasks, i), TRUE);
+  jsonrpc_output_batch_free (batch);
 
   jsonrpc_output_stream_pump (self);
 }
@@ -353,7 +470,7 @@ jsonrpc_output_stream_write_message_async (JsonrpcOutputStream *self,
                                            gpointer             user_data)
 {
   JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
-  g_autoptr(GBytes) bytes = NULL;
+  JsonrpcOutputMessage *msg;
   g_autoptr(GTask) task = NULL;
   g_autoptr(GError) error = NULL;
 
@@ -365,13 +482,13 @@ jsonrpc_output_stream_write_message_async (JsonrpcOutputStream *self,
   g_task_set_source_tag (task, jsonrpc_output_stream_write_message_async);
   g_task_set_priority (task, G_PRIORITY_LOW);
 
-  if (NULL == (bytes = jsonrpc_output_stream_create_bytes (self, message, &error)))
+  if (NULL == (msg = jsonrpc_output_stream_create_message (self, message, &error)))
     {
       g_task_return_error (task, g_steal_pointer (&error));
       return;
     }
 
-  g_task_set_task_data (task, g_steal_pointer (&bytes), (GDestroyNotify)g_bytes_unref);
+  g_task_set_task_data (task, msg, (GDestroyNotify)jsonrpc_output_message_free);
   g_queue_push_tail (&priv->queue, g_steal_pointer (&task));
   jsonrpc_output_stream_pump (self);
 }
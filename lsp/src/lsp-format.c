@@ -24,6 +24,7 @@
 #include "lsp-server.h"
 #include "lsp-utils.h"
 #include "lsp-rpc.h"
+#include "lsp-sync.h"
 
 #include <jsonrpc-glib.h>
 
@@ -48,9 +49,7 @@ static void format_cb(GVariant *return_value, GError *error, gpointer user_data)
 		g_variant_iter_init(&iter, return_value);
 		edits = lsp_utils_parse_text_edits(&iter);
 
-		sci_start_undo_action(doc->editor->sci);
-		lsp_utils_apply_text_edits(doc->editor->sci, NULL, edits, FALSE);
-		sci_end_undo_action(doc->editor->sci);
+		lsp_sync_apply_text_edits(lsp_server_get_if_running(doc), doc, edits);
 
 		g_ptr_array_free(edits, TRUE);
 
@@ -25,46 +25,251 @@
 #include "lsp-symbols.h"
 #include "lsp-utils.h"
 #include "lsp-symbol.h"
+#include "lsp-symbol-index.h"
 
 #include <gtk/gtk.h>
 #include <geanyplugin.h>
+#include <string.h>
 
 
+/* delay after the last keystroke before workspace symbols are requested */
+#define WORKSPACE_SYMBOL_DELAY 200
+/* servers typically cap the number of returned workspace symbols (e.g. clangd
+ * and gopls to 100) - smaller results are assumed to contain all matches */
+#define WORKSPACE_SYMBOL_COMPLETE_MAX 100
+
+
+extern GeanyData *geany_data;
+extern GeanyPlugin *geany_plugin;
+
+static struct
+{
+	guint source_id;      /* debounce timeout */
+	gchar *pending_query; /* query waiting for the debounce timeout */
+	GCancellable *cancellable;
+	guint seq;            /* identifies the latest request; replies to older ones are dropped */
+	gchar *query;         /* query of the last received result */
+	GPtrArray *result;
+	gboolean complete;
+} ws_lookup;
+
 typedef struct
 {
-	GeanyDocument *doc;
-	gchar *query;
-} DocQueryData;
+	const gchar *key;   /* normalized and casefolded name */
+	const gchar *name;
+	const gchar *file;  /* utf8 */
+	gulong line;
+	TMTagType type;
+} TmIndexEntry;
+
+/* sorted workspace TagManager tags of a single language used when the server
+ * doesn't support workspace symbols */
+static struct
+{
+	GStringChunk *chunk;
+	GArray *entries;
+	TMParserType lang;
+} tm_index;
 
+/* document for which documentSymbol request is in progress */
+static GeanyDocument *doc_symbols_pending_doc;
+/* the last "@" query typed into the panel, without the prefix */
+static gchar *doc_symbols_query;
+
+
+static void workspace_lookup_cancel(void)
+{
+	if (ws_lookup.source_id)
+		g_source_remove(ws_lookup.source_id);
+	ws_lookup.source_id = 0;
+
+	if (ws_lookup.cancellable)
+	{
+		g_cancellable_cancel(ws_lookup.cancellable);
+		g_clear_object(&ws_lookup.cancellable);
+	}
+
+	ws_lookup.seq++;
+}
 
-extern GeanyData *geany_data;
+
+static void workspace_lookup_reset(void)
+{
+	workspace_lookup_cancel();
+
+	g_clear_pointer(&ws_lookup.pending_query, g_free);
+	g_clear_pointer(&ws_lookup.query, g_free);
+	g_clear_pointer(&ws_lookup.result, g_ptr_array_unref);
+	ws_lookup.complete = FALSE;
+}
+
+
+/* servers use fuzzy matching for workspace symbols - when narrowing their
+ * result locally, match characters of the query as a subsequence of the name */
+static gboolean fuzzy_match(const gchar *name, const gchar *query)
+{
+	const gchar *p = name;
+	const gchar *q;
+
+	for (q = query; *q; q = g_utf8_next_char(q))
+	{
+		gunichar c = g_utf8_get_char(q);
+
+		if (c == ' ')
+			continue;
+
+		while (*p && g_utf8_get_char(p) != c)
+			p = g_utf8_next_char(p);
+
+		if (!*p)
+			return FALSE;
+		p = g_utf8_next_char(p);
+	}
+
+	return TRUE;
+}
+
+
+static void workspace_lookup_fill_narrowed(const gchar *query)
+{
+	GPtrArray *filtered = g_ptr_array_new();
+	gchar *case_normalized_query = lsp_utils_normalize_casefold(query);
+	LspSymbol *sym;
+	guint i;
+
+	foreach_ptr_array(sym, i, ws_lookup.result)
+	{
+		gchar *case_normalized_name = lsp_utils_normalize_casefold(lsp_symbol_get_name(sym));
+
+		if (fuzzy_match(case_normalized_name, case_normalized_query))
+			g_ptr_array_add(filtered, sym);
+
+		g_free(case_normalized_name);
+	}
+
+	lsp_goto_panel_fill(filtered);
+
+	g_ptr_array_free(filtered, TRUE);
+	g_free(case_normalized_query);
+}
+
+
+/* shows symbols from the persistent index, returns FALSE if there are none */
+static gboolean fill_index_symbols(GeanyDocument *doc, const gchar *query)
+{
+	GPtrArray *symbols;
+	gboolean found;
+
+	if (!doc)
+		return FALSE;
+
+	symbols = lsp_symbol_index_query(doc->file_type->id, query, GOTO_PANEL_MAX_MATCHES);
+	found = symbols->len > 0;
+	if (found)
+		lsp_goto_panel_fill(symbols);
+
+	g_ptr_array_free(symbols, TRUE);
+	return found;
+}
 
 
 static void workspace_symbol_cb(GPtrArray *symbols, gpointer user_data)
 {
-	lsp_goto_panel_fill(symbols);
+	LspSymbol *sym;
+	guint i;
+
+	// superseded by a newer query
+	if (GPOINTER_TO_UINT(user_data) != ws_lookup.seq || !symbols)
+		return;
+
+	g_clear_object(&ws_lookup.cancellable);
+
+	if (ws_lookup.result)
+		g_ptr_array_unref(ws_lookup.result);
+	ws_lookup.result = g_ptr_array_new_full(symbols->len, (GDestroyNotify)lsp_symbol_unref);
+	foreach_ptr_array(sym, i, symbols)
+		g_ptr_array_add(ws_lookup.result, lsp_symbol_ref(sym));
+
+	SETPTR(ws_lookup.query, ws_lookup.pending_query);
+	ws_lookup.pending_query = NULL;
+	ws_lookup.complete = symbols->len < WORKSPACE_SYMBOL_COMPLETE_MAX;
+
+	// the server may still be indexing the workspace - keep showing symbols
+	// from the index in that case
+	if (symbols->len > 0 || !fill_index_symbols(document_get_current(), ws_lookup.query))
+		lsp_goto_panel_fill(symbols);
 }
 
 
-static void doc_symbol_cb(gpointer user_data)
+static gboolean workspace_lookup_timeout(gpointer user_data)
 {
-	DocQueryData *data = user_data;
 	GeanyDocument *doc = document_get_current();
-	gchar *text = data->query;
-	GPtrArray *symbols;
-	GPtrArray *filtered;
 
-	if (doc != data->doc)
+	ws_lookup.source_id = 0;
+
+	if (!doc || !ws_lookup.pending_query)
+		return G_SOURCE_REMOVE;
+
+	ws_lookup.cancellable = g_cancellable_new();
+	lsp_symbols_workspace_request(doc, ws_lookup.pending_query, ws_lookup.cancellable,
+		workspace_symbol_cb, GUINT_TO_POINTER(ws_lookup.seq));
+
+	return G_SOURCE_REMOVE;
+}
+
+
+static void workspace_lookup(const gchar *query)
+{
+	// supersede any previous request, even if the result for query can be
+	// computed locally so an older reply doesn't overwrite it
+	workspace_lookup_cancel();
+
+	if (ws_lookup.query && ws_lookup.result && g_str_has_prefix(query, ws_lookup.query) &&
+		(ws_lookup.complete || g_strcmp0(query, ws_lookup.query) == 0))
+	{
+		g_clear_pointer(&ws_lookup.pending_query, g_free);
+		workspace_lookup_fill_narrowed(query);
 		return;
+	}
 
-	symbols = lsp_symbols_doc_get_cached(doc);
+	// show something immediately, the server result replaces it
+	fill_index_symbols(document_get_current(), query);
 
-	filtered = lsp_goto_panel_filter(symbols, text[0] ? text + 1 : text);
-	lsp_goto_panel_fill(filtered);
+	SETPTR(ws_lookup.pending_query, g_strdup(query));
+	ws_lookup.source_id = plugin_timeout_add(geany_plugin, WORKSPACE_SYMBOL_DELAY,
+		workspace_lookup_timeout, NULL);
+}
+
+
+static void fill_doc_symbols(GeanyDocument *doc, const gchar *filter)
+{
+	GPtrArray *symbols = lsp_symbols_doc_get_cached(doc);
+	GPtrArray *filtered;
 
+	if (symbols)
+		filtered = lsp_goto_panel_filter(symbols, filter);
+	else
+		filtered = g_ptr_array_new();
+
+	lsp_goto_panel_fill(filtered);
 	g_ptr_array_free(filtered, TRUE);
-	g_free(data->query);
-	g_free(data);
+}
+
+
+static void doc_symbol_cb(gpointer user_data)
+{
+	GeanyDocument *doc = user_data;
+
+	if (doc != doc_symbols_pending_doc)
+		return;
+
+	doc_symbols_pending_doc = NULL;
+
+	// the user may have switched to a different query type in the meantime
+	if (doc != document_get_current() || !doc_symbols_query)
+		return;
+
+	fill_doc_symbols(doc, doc_symbols_query);
 }
 
 
@@ -203,28 +408,187 @@ static void goto_tm_symbol(const gchar *query, GPtrArray *tags, TMParserType lan
 }
 
 
+static gint compare_tm_entries(gconstpointer a, gconstpointer b)
+{
+	const TmIndexEntry *e1 = a;
+	const TmIndexEntry *e2 = b;
+
+	return strcmp(e1->key, e2->key);
+}
+
+
+static void tm_index_clear(void)
+{
+	if (tm_index.entries)
+		g_array_free(tm_index.entries, TRUE);
+	if (tm_index.chunk)
+		g_string_chunk_free(tm_index.chunk);
+	tm_index.entries = NULL;
+	tm_index.chunk = NULL;
+}
+
+
+/* strings are copied into the chunk so the index doesn't depend on the lifetime
+ * of TagManager tags */
+static void tm_index_build(TMParserType lang)
+{
+	GPtrArray *tags = geany_data->app->tm_workspace->tags_array;
+	GHashTable *file_names = g_hash_table_new(NULL, NULL);
+	TMTag *tag;
+	guint i;
+
+	tm_index_clear();
+
+	tm_index.lang = lang;
+	tm_index.chunk = g_string_chunk_new(4096);
+	tm_index.entries = g_array_new(FALSE, FALSE, sizeof(TmIndexEntry));
+
+	foreach_ptr_array(tag, i, tags)
+	{
+		TmIndexEntry entry;
+		gchar *key;
+
+		if (tag->lang != lang || tag->type == tm_tag_local_var_t || !tag->file)
+			continue;
+
+		entry.file = g_hash_table_lookup(file_names, tag->file);
+		if (!entry.file)
+		{
+			gchar *file_name = utils_get_utf8_from_locale(tag->file->file_name);
+
+			entry.file = g_string_chunk_insert_const(tm_index.chunk, file_name);
+			g_hash_table_insert(file_names, tag->file, (gpointer) entry.file);
+			g_free(file_name);
+		}
+
+		key = lsp_utils_normalize_casefold(tag->name);
+		entry.key = g_string_chunk_insert(tm_index.chunk, key);
+		entry.name = strcmp(key, tag->name) == 0 ?
+			entry.key : g_string_chunk_insert(tm_index.chunk, tag->name);
+		entry.line = tag->line;
+		entry.type = tag->type;
+		g_free(key);
+
+		g_array_append_val(tm_index.entries, entry);
+	}
+
+	g_array_sort(tm_index.entries, compare_tm_entries);
+
+	g_hash_table_destroy(file_names);
+}
+
+
+static gboolean tm_entry_matches(const TmIndexEntry *entry, gchar **terms)
+{
+	gchar **term;
+
+	foreach_strv(term, terms)
+	{
+		if (**term && !strstr(entry->key, *term))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+static void add_tm_entry(GPtrArray *arr, const TmIndexEntry *entry)
+{
+	TMIcon icon = lsp_symbol_kinds_get_symbol_icon(lsp_symbol_kinds_tm_to_lsp(entry->type));
+
+	g_ptr_array_add(arr, lsp_symbol_new(entry->name, "", "", entry->file, 0, 0,
+		entry->line, 0, icon));
+}
+
+
+/* Fills at most GOTO_PANEL_MAX_MATCHES workspace tags matching query. Symbols
+ * starting with the query are found using binary search and are listed first,
+ * remaining slots are filled with symbols containing all the query terms. */
+static void goto_tm_workspace_symbol(const gchar *query, TMParserType lang)
+{
+	GPtrArray *arr = g_ptr_array_new_full(0, (GDestroyNotify)lsp_symbol_unref);
+	gchar *key = lsp_utils_normalize_casefold(query);
+	gchar **terms = g_strsplit(key, " ", -1);
+	const gchar *prefix = terms[0] ? terms[0] : "";
+	guint lo, hi, first_prefix, i;
+
+	if (!tm_index.entries || tm_index.lang != lang)
+		tm_index_build(lang);
+
+	lo = 0;
+	hi = tm_index.entries->len;
+	while (lo < hi)
+	{
+		guint mid = lo + (hi - lo) / 2;
+
+		if (strcmp(g_array_index(tm_index.entries, TmIndexEntry, mid).key, prefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	first_prefix = lo;
+
+	for (i = first_prefix; i < tm_index.entries->len && arr->len < GOTO_PANEL_MAX_MATCHES; i++)
+	{
+		TmIndexEntry *entry = &g_array_index(tm_index.entries, TmIndexEntry, i);
+
+		if (!g_str_has_prefix(entry->key, prefix))
+			break;
+		if (tm_entry_matches(entry, terms))
+			add_tm_entry(arr, entry);
+	}
+
+	for (i = 0; *prefix && i < tm_index.entries->len && arr->len < GOTO_PANEL_MAX_MATCHES; i++)
+	{
+		TmIndexEntry *entry = &g_array_index(tm_index.entries, TmIndexEntry, i);
+
+		if (!g_str_has_prefix(entry->key, prefix) && tm_entry_matches(entry, terms))
+			add_tm_entry(arr, entry);
+	}
+
+	if (arr->len > 0 || !fill_index_symbols(document_get_current(), query))
+		lsp_goto_panel_fill(arr);
+
+	g_strfreev(terms);
+	g_free(key);
+	g_ptr_array_free(arr, TRUE);
+}
+
+
 static void perform_lookup(const gchar *query)
 {
 	GeanyDocument *doc = document_get_current();
 	const gchar *query_str = query ? query : "";
 	LspServer *srv = lsp_server_get(doc);
 
+	g_free(doc_symbols_query);
+	doc_symbols_query = NULL;
+
+	if (!g_str_has_prefix(query_str, "#"))
+		workspace_lookup_cancel();
+
 	if (g_str_has_prefix(query_str, "#"))
 	{
 		if (srv && srv->supports_workspace_symbols)
-			lsp_symbols_workspace_request(doc, query_str+1, workspace_symbol_cb, NULL);
+			workspace_lookup(query_str+1);
 		else if (doc)
-			// TODO: possibly improve performance by binary searching the start and the end point
-			goto_tm_symbol(query_str+1, geany_data->app->tm_workspace->tags_array, doc->file_type->lang);
+			goto_tm_workspace_symbol(query_str+1, doc->file_type->lang);
 	}
 	else if (g_str_has_prefix(query_str, "@"))
 	{
 		if (srv && srv->config.document_symbols_available)
 		{
-			DocQueryData *data = g_new0(DocQueryData, 1);
-			data->query = g_strdup(query_str);
-			data->doc = doc;
-			lsp_symbols_doc_request(doc, doc_symbol_cb, data);
+			SETPTR(doc_symbols_query, g_strdup(query_str+1));
+
+			// filter locally, possibly using the outdated symbols until the
+			// server returns the up-to-date ones
+			fill_doc_symbols(doc, doc_symbols_query);
+
+			if (!lsp_symbols_doc_cache_valid(doc) && doc_symbols_pending_doc != doc)
+			{
+				doc_symbols_pending_doc = doc;
+				lsp_symbols_doc_request(doc, doc_symbol_cb, doc);
+			}
 		}
 		else if (doc)
 		{
@@ -259,6 +623,14 @@ static void goto_panel_query(const gchar *query_type, gboolean prefill)
 		query = g_strdup("");
 	SETPTR(query, g_strconcat(query_type, query, NULL));
 
+	// in case the last request never returned
+	doc_symbols_pending_doc = NULL;
+	// the previous result might be for a different server or outdated
+	workspace_lookup_reset();
+	// TagManager tags may have changed since the panel was shown last time,
+	// they cannot change while the panel is open
+	tm_index_clear();
+
 	lsp_goto_panel_show(query, perform_lookup);
 
 	g_free(query);
@@ -287,3 +659,14 @@ void lsp_goto_anywhere_for_file(void)
 {
 	goto_panel_query("", FALSE);
 }
+
+
+void lsp_goto_anywhere_destroy(void)
+{
+	workspace_lookup_reset();
+	tm_index_clear();
+
+	g_free(doc_symbols_query);
+	doc_symbols_query = NULL;
+	doc_symbols_pending_doc = NULL;
+}
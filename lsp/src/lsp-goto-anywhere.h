@@ -25,4 +25,6 @@ void lsp_goto_anywhere_for_doc(void);
 void lsp_goto_anywhere_for_line(void);
 void lsp_goto_anywhere_for_file(void);
 
+void lsp_goto_anywhere_destroy(void);
+
 #endif  /* LSP_GOTO_ANYWHERE_H */
@@ -0,0 +1,311 @@
+/*
+ * Copyright 2024 Jiri Techet <techet@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/* Shows locations (e.g. references) in the messages window. Lines of files
+ * which aren't open are read by a thread pool and the messages window is
+ * filled in batches from idle callbacks so large results don't block the
+ * UI. Locations can be added in several parts as they arrive from the
+ * server. */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "lsp-goto-msgwin.h"
+#include "lsp-line-reader.h"
+#include "lsp-utils.h"
+
+#include <geanyplugin.h>
+
+
+#define MSGWIN_BATCH_SIZE 200
+#define MAX_READER_THREADS 4
+
+
+typedef struct
+{
+	gint refcount;
+	gint done;       /* texts are ready */
+	gint cancelled;  /* result not needed any more */
+	gchar *fname;    /* utf8 */
+	gchar *display_name;
+	GArray *lines;   /* gint, sorted */
+	gchar **texts;   /* lines->len strings, NULL when the line couldn't be read */
+	guint emitted;   /* number of lines already added to the messages window */
+} FileJob;
+
+
+static struct
+{
+	guint id;
+	GQueue jobs;  /* FileJob* in the order in which they are shown */
+	GThreadPool *pool;
+	gchar *base_path;
+	gint scheduled;  /* add_batch() idle source exists */
+} s_msgwin = {0, G_QUEUE_INIT, NULL, NULL, FALSE};
+
+
+static void file_job_unref(FileJob *job)
+{
+	guint i;
+
+	if (!g_atomic_int_dec_and_test(&job->refcount))
+		return;
+
+	if (job->texts)
+	{
+		for (i = 0; i < job->lines->len; i++)
+			g_free(job->texts[i]);
+		g_free(job->texts);
+	}
+	g_array_free(job->lines, TRUE);
+	g_free(job->display_name);
+	g_free(job->fname);
+	g_free(job);
+}
+
+
+static FileJob *file_job_new(const gchar *fname)
+{
+	FileJob *job = g_new0(FileJob, 1);
+	gchar *rel_path = NULL;
+
+	job->refcount = 1;
+	job->fname = g_strdup(fname);
+	job->lines = g_array_new(FALSE, FALSE, sizeof(gint));
+
+	if (s_msgwin.base_path)
+		rel_path = lsp_utils_get_relative_path(s_msgwin.base_path, fname);
+	if (rel_path && !g_str_has_prefix(rel_path, ".."))
+		job->display_name = rel_path;
+	else
+	{
+		job->display_name = g_strdup(fname);
+		g_free(rel_path);
+	}
+
+	return job;
+}
+
+
+static gboolean add_batch(gpointer user_data)
+{
+	guint count = 0;
+
+	while (!g_queue_is_empty(&s_msgwin.jobs))
+	{
+		FileJob *job = g_queue_peek_head(&s_msgwin.jobs);
+
+		if (!g_atomic_int_get(&job->done))
+		{
+			/* the worker schedules us again once it's done - unless it
+			 * finished before the flag got cleared */
+			g_atomic_int_set(&s_msgwin.scheduled, FALSE);
+			if (!g_atomic_int_get(&job->done) ||
+				!g_atomic_int_compare_and_exchange(&s_msgwin.scheduled, FALSE, TRUE))
+				return G_SOURCE_REMOVE;
+			continue;
+		}
+
+		for (; job->emitted < job->lines->len && count < MSGWIN_BATCH_SIZE; job->emitted++, count++)
+		{
+			const gchar *text = job->texts[job->emitted];
+
+			msgwin_msg_add(COLOR_BLACK, -1, NULL, "%s:%d:  %s", job->display_name,
+				g_array_index(job->lines, gint, job->emitted) + 1, text ? text : "");
+		}
+
+		if (job->emitted < job->lines->len)
+			return G_SOURCE_CONTINUE;
+
+		g_queue_pop_head(&s_msgwin.jobs);
+		file_job_unref(job);
+	}
+
+	g_atomic_int_set(&s_msgwin.scheduled, FALSE);
+	return G_SOURCE_REMOVE;
+}
+
+
+/* a single source fills the messages window so its output stays
+ * MSGWIN_BATCH_SIZE lines per main loop iteration */
+static void schedule_add_batch(void)
+{
+	/* not plugin_idle_add() - called from worker threads too */
+	if (g_atomic_int_compare_and_exchange(&s_msgwin.scheduled, FALSE, TRUE))
+		g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, add_batch, &s_msgwin, NULL);
+}
+
+
+static void read_lines(gpointer data, gpointer user_data)
+{
+	FileJob *job = data;
+
+	if (!g_atomic_int_get(&job->cancelled))
+	{
+		gchar **texts = g_new0(gchar *, job->lines->len);
+		guint i;
+
+		lsp_line_reader_get_lines(job->fname, (gint *)(gpointer)job->lines->data, job->lines->len, texts);
+		for (i = 0; i < job->lines->len; i++)
+		{
+			if (texts[i])
+				g_strstrip(texts[i]);
+		}
+		job->texts = texts;
+
+		g_atomic_int_set(&job->done, TRUE);
+		schedule_add_batch();
+	}
+
+	file_job_unref(job);
+}
+
+
+static void cancel_jobs(void)
+{
+	FileJob *job;
+
+	while ((job = g_queue_pop_head(&s_msgwin.jobs)))
+	{
+		g_atomic_int_set(&job->cancelled, TRUE);
+		file_job_unref(job);
+	}
+}
+
+
+/* clears the messages window for a new result and returns its id */
+guint lsp_goto_msgwin_start(void)
+{
+	cancel_jobs();
+
+	msgwin_clear_tab(MSG_MESSAGE);
+	msgwin_switch_tab(MSG_MESSAGE, TRUE);
+
+	SETPTR(s_msgwin.base_path, lsp_utils_get_project_base_path());
+	if (s_msgwin.base_path)
+	{
+		gchar *locale_base_path = utils_get_locale_from_utf8(s_msgwin.base_path);
+
+		msgwin_set_messages_dir(locale_base_path);
+		g_free(locale_base_path);
+	}
+
+	return ++s_msgwin.id;
+}
+
+
+static gint compare_lines(gconstpointer a, gconstpointer b)
+{
+	return *((const gint *) a) - *((const gint *) b);
+}
+
+
+/* adds a part of the result with the given id, locations within a part are
+ * grouped by file so every file is read only once */
+void lsp_goto_msgwin_add(guint id, GPtrArray *locations)
+{
+	/* utf8 file name -> FileJob* */
+	GHashTable *file_table;
+	GPtrArray *jobs;
+	LspLocation *loc;
+	FileJob *job;
+	guint i;
+
+	if (id != s_msgwin.id || !locations)
+		return;
+
+	file_table = g_hash_table_new(g_str_hash, g_str_equal);
+	jobs = g_ptr_array_new();
+
+	foreach_ptr_array(loc, i, locations)
+	{
+		gchar *fname = lsp_utils_get_real_path_from_uri_utf8(loc->uri);
+		gint line = loc->range.start.line;
+
+		if (!fname)
+			continue;
+
+		job = g_hash_table_lookup(file_table, fname);
+		if (!job)
+		{
+			job = file_job_new(fname);
+			g_hash_table_insert(file_table, job->fname, job);
+			g_ptr_array_add(jobs, job);
+		}
+		g_array_append_val(job->lines, line);
+
+		g_free(fname);
+	}
+
+	foreach_ptr_array(job, i, jobs)
+	{
+		GeanyDocument *doc = document_find_by_filename(job->fname);
+
+		g_array_sort(job->lines, compare_lines);
+		g_queue_push_tail(&s_msgwin.jobs, job);
+
+		if (doc)
+		{
+			/* the document may be modified, read what the user sees */
+			guint j;
+
+			job->texts = g_new0(gchar *, job->lines->len);
+			for (j = 0; j < job->lines->len; j++)
+			{
+				job->texts[j] = sci_get_line(doc->editor->sci, g_array_index(job->lines, gint, j));
+				g_strstrip(job->texts[j]);
+			}
+			job->done = TRUE;
+		}
+		else
+		{
+			if (!s_msgwin.pool)
+			{
+				s_msgwin.pool = g_thread_pool_new(read_lines, NULL,
+					MIN(g_get_num_processors(), MAX_READER_THREADS), FALSE, NULL);
+			}
+			g_atomic_int_inc(&job->refcount);
+			g_thread_pool_push(s_msgwin.pool, job, NULL);
+		}
+	}
+
+	if (jobs->len > 0)
+		schedule_add_batch();
+
+	g_ptr_array_free(jobs, TRUE);
+	g_hash_table_destroy(file_table);
+}
+
+
+void lsp_goto_msgwin_destroy(void)
+{
+	cancel_jobs();
+
+	/* let the workers drop their references to the cancelled jobs */
+	if (s_msgwin.pool)
+		g_thread_pool_free(s_msgwin.pool, FALSE, TRUE);
+	s_msgwin.pool = NULL;
+
+	while (g_source_remove_by_user_data(&s_msgwin))
+		;
+	s_msgwin.scheduled = FALSE;
+
+	g_free(s_msgwin.base_path);
+	s_msgwin.base_path = NULL;
+}
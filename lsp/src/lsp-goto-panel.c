@@ -406,7 +406,7 @@ GPtrArray *lsp_goto_panel_filter(GPtrArray *symbols, const gchar *filter)
 
 	tf_strv = g_strsplit_set(case_normalized_filter, " ", -1);
 
-	for (i = 0; i < symbols->len && j < 20; i++)
+	for (i = 0; i < symbols->len && j < GOTO_PANEL_MAX_MATCHES; i++)
 	{
 		LspSymbol *symbol = symbols->pdata[i];
 		gboolean filtered = FALSE;
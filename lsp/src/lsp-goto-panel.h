@@ -21,6 +21,9 @@
 
 #include <glib.h>
 
+/* maximum number of entries shown for filtered queries */
+#define GOTO_PANEL_MAX_MATCHES 20
+
 typedef void (*LspGotoPanelLookupFunction) (const char *);
 
 void lsp_goto_panel_show(const gchar *query, LspGotoPanelLookupFunction func);
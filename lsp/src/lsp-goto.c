@@ -25,20 +25,24 @@
 #include "lsp-rpc.h"
 #include "lsp-goto-panel.h"
 #include "lsp-symbol.h"
+#include "lsp-goto-msgwin.h"
+#include "lsp-progress.h"
 
 #include <jsonrpc-glib.h>
 
 
 typedef struct {
 	GeanyDocument *doc;
+	LspServer *server;  // the one the request was sent to
 	gboolean show_in_msgwin;
+	guint msgwin_id;
+	gchar *partial_result_token;
 } GotoData;
 
 
 extern GeanyData *geany_data;
 
 
-// TODO: free on plugin unload
 GPtrArray *last_result;
 
 
@@ -71,78 +75,42 @@ static void filter_symbols(const gchar *filter)
 }
 
 
-static void show_in_msgwin(LspLocation *loc, GHashTable *sci_table)
+static void add_to_msgwin(guint msgwin_id, GVariant *locations_variant)
 {
-	ScintillaObject *sci = NULL;
-	gint lineno = loc->range.start.line;
-	gchar *fname, *base_path;
-	GeanyDocument *doc;
-	gchar *line_str;
-
-	fname = lsp_utils_get_real_path_from_uri_utf8(loc->uri);
-	if (!fname)
-		return;
-
-	doc = document_find_by_filename(fname);
-	base_path = lsp_utils_get_project_base_path();
-
-	if (doc)
-		sci = doc->editor->sci;
-	else
-	{
-		if (sci_table)
-			sci = g_hash_table_lookup(sci_table, fname);
-		if (!sci)
-		{
-			sci = lsp_utils_new_sci_from_file(fname);
-			if (sci && sci_table)
-				g_hash_table_insert(sci_table, g_strdup(fname), g_object_ref_sink(sci));
-		}
-	}
-
-	line_str = sci ? sci_get_line(sci, lineno) : g_strdup("");
-	g_strstrip(line_str);
-
-	if (base_path)
-	{
-		gchar *rel_path = lsp_utils_get_relative_path(base_path, fname);
-		gchar *locale_base_path = utils_get_locale_from_utf8(base_path);
-
-		if (rel_path && !g_str_has_prefix(rel_path, ".."))
-			SETPTR(fname, g_strdup(rel_path));
-
-		msgwin_set_messages_dir(locale_base_path);
+	GPtrArray *locations;
+	GVariantIter iter;
+
+	g_variant_iter_init(&iter, locations_variant);
+	locations = lsp_utils_parse_locations(&iter);
+	lsp_goto_msgwin_add(msgwin_id, locations);
+	if (locations)
+		g_ptr_array_free(locations, TRUE);
+}
 
-		g_free(locale_base_path);
-		g_free(rel_path);
-	}
-	msgwin_msg_add(COLOR_BLACK, -1, NULL, "%s:%d:  %s", fname, lineno + 1, line_str);
 
-	g_free(line_str);
-	g_free(fname);
-	g_free(base_path);
-	if (!sci_table && !doc)
+static void partial_result_cb(GVariant *value, gpointer user_data)
+{
+	if (g_variant_is_of_type(value, G_VARIANT_TYPE_ARRAY) &&
+		!g_variant_is_of_type(value, G_VARIANT_TYPE_DICTIONARY))
 	{
-		g_object_ref_sink(sci);
-		g_object_unref(sci);
+		add_to_msgwin(GPOINTER_TO_UINT(user_data), value);
 	}
 }
 
 
 static void goto_cb(GVariant *return_value, GError *error, gpointer user_data)
 {
+	GotoData *data = user_data;
+
+	// also when the document was closed or the server replaced - tokens of
+	// freed servers were freed with them
+	if (data->partial_result_token && lsp_server_is_alive(data->server))
+		lsp_progress_partial_result_free(data->server, data->partial_result_token);
+
 	if (!error)
 	{
-		GotoData *data = user_data;
-
 		if (DOC_VALID(data->doc))
 		{
-			if (data->show_in_msgwin)
-			{
-				msgwin_clear_tab(MSG_MESSAGE);
-				msgwin_switch_tab(MSG_MESSAGE, TRUE);
-			}
-
 			// single location
 
 			/* check G_VARIANT_TYPE_DICTIONARY ("a{?*}") before
@@ -155,7 +123,13 @@ static void goto_cb(GVariant *return_value, GError *error, gpointer user_data)
 				if (loc)
 				{
 					if (data->show_in_msgwin)
-						show_in_msgwin(loc, NULL);
+					{
+						GPtrArray *locations = g_ptr_array_new();
+
+						g_ptr_array_add(locations, loc);
+						lsp_goto_msgwin_add(data->msgwin_id, locations);
+						g_ptr_array_free(locations, TRUE);
+					}
 					else
 						goto_location(data->doc, loc);
 				}
@@ -175,19 +149,7 @@ static void goto_cb(GVariant *return_value, GError *error, gpointer user_data)
 				if (locations && locations->len > 0)
 				{
 					if (data->show_in_msgwin)
-					{
-						GHashTable *sci_table = g_hash_table_new_full(g_str_hash,
-							g_str_equal, g_free, (GDestroyNotify)g_object_unref);
-						LspLocation *loc;
-						guint j;
-
-						foreach_ptr_array(loc, j, locations)
-						{
-							show_in_msgwin(loc, sci_table);
-						}
-
-						g_hash_table_destroy(sci_table);
-					}
+						lsp_goto_msgwin_add(data->msgwin_id, locations);
 					else if (locations->len == 1)
 						goto_location(data->doc, locations->pdata[0]);
 					else
@@ -231,7 +193,8 @@ static void goto_cb(GVariant *return_value, GError *error, gpointer user_data)
 		//printf("%s\n\n\n", lsp_utils_json_pretty_print(return_value));
 	}
 
-	g_free(user_data);
+	g_free(data->partial_result_token);
+	g_free(data);
 }
 
 
@@ -244,21 +207,48 @@ static void perform_goto(LspServer *server, GeanyDocument *doc, gint pos, const
 	gchar *doc_uri = lsp_utils_get_doc_uri(doc);
 	GotoData *data = g_new0(GotoData, 1);
 
-	node = JSONRPC_MESSAGE_NEW (
-		"textDocument", "{",
-			"uri", JSONRPC_MESSAGE_PUT_STRING(doc_uri),
-		"}",
-		"position", "{",
-			"line", JSONRPC_MESSAGE_PUT_INT32(lsp_pos.line),
-			"character", JSONRPC_MESSAGE_PUT_INT32(lsp_pos.character),
-		"}",
-		"context", "{",  // only for textDocument/references
-			"includeDeclaration", JSONRPC_MESSAGE_PUT_BOOLEAN(TRUE),
-		"}"
-	);
-
 	data->doc = doc;
+	data->server = server;
 	data->show_in_msgwin = show_in_msgwin;
+
+	if (show_in_msgwin)
+	{
+		/* servers supporting partial results send the locations in parts
+		 * before the (then empty) response */
+		data->msgwin_id = lsp_goto_msgwin_start();
+		data->partial_result_token = g_strdup(lsp_progress_partial_result_new(server,
+			partial_result_cb, GUINT_TO_POINTER(data->msgwin_id)));
+
+		node = JSONRPC_MESSAGE_NEW (
+			"textDocument", "{",
+				"uri", JSONRPC_MESSAGE_PUT_STRING(doc_uri),
+			"}",
+			"position", "{",
+				"line", JSONRPC_MESSAGE_PUT_INT32(lsp_pos.line),
+				"character", JSONRPC_MESSAGE_PUT_INT32(lsp_pos.character),
+			"}",
+			"context", "{",  // only for textDocument/references
+				"includeDeclaration", JSONRPC_MESSAGE_PUT_BOOLEAN(TRUE),
+			"}",
+			"partialResultToken", JSONRPC_MESSAGE_PUT_STRING(data->partial_result_token)
+		);
+	}
+	else
+	{
+		node = JSONRPC_MESSAGE_NEW (
+			"textDocument", "{",
+				"uri", JSONRPC_MESSAGE_PUT_STRING(doc_uri),
+			"}",
+			"position", "{",
+				"line", JSONRPC_MESSAGE_PUT_INT32(lsp_pos.line),
+				"character", JSONRPC_MESSAGE_PUT_INT32(lsp_pos.character),
+			"}",
+			"context", "{",  // only for textDocument/references
+				"includeDeclaration", JSONRPC_MESSAGE_PUT_BOOLEAN(TRUE),
+			"}"
+		);
+	}
+
 	lsp_rpc_call(server, request, node, goto_cb, data);
 
 	g_free(doc_uri);
@@ -324,3 +314,11 @@ void lsp_goto_references(gint pos)
 
 	perform_goto(srv, doc, pos, "textDocument/references", TRUE);
 }
+
+
+void lsp_goto_destroy(void)
+{
+	if (last_result)
+		g_ptr_array_free(last_result, TRUE);
+	last_result = NULL;
+}
@@ -30,4 +30,6 @@ void lsp_goto_type_definition(gint pos);
 void lsp_goto_implementations(gint pos);
 void lsp_goto_references(gint pos);
 
+void lsp_goto_destroy(void);
+
 #endif  /* LSP_GOTO_H */
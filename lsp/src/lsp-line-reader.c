@@ -0,0 +1,282 @@
+/*
+ * Copyright 2024 Jiri Techet <techet@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/* Reads individual lines of files which aren't open in Geany, e.g. for
+ * showing references in the message window. Files are mapped into memory
+ * and the positions of line starts are remembered, so reading more lines
+ * from a recently used file doesn't touch the disk again. Can be used from
+ * worker threads. */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "lsp-line-reader.h"
+#include "lsp-utils.h"
+
+#include <geanyplugin.h>
+
+#include <glib/gstdio.h>
+#include <string.h>
+
+
+#define LINE_READER_CACHE_SIZE 32
+
+
+typedef struct
+{
+	gint refcount;
+	GMutex lock;   /* protects line_starts and scanned */
+	gchar *fname;  /* utf8 */
+	GMappedFile *mapped;
+	gint64 mtime;
+	goffset size;
+	GArray *line_starts;  /* gsize offsets of the lines found so far */
+	gsize scanned;        /* the file has been searched for newlines up to here */
+} LineFile;
+
+
+/* most recently used files first, protected by the lru lock */
+G_LOCK_DEFINE_STATIC(lru);
+static GQueue lru = G_QUEUE_INIT;
+/* utf8 file name -> GList link in lru */
+static GHashTable *lru_table = NULL;
+
+
+static void line_file_unref(LineFile *file)
+{
+	if (!g_atomic_int_dec_and_test(&file->refcount))
+		return;
+
+	g_mutex_clear(&file->lock);
+	if (file->mapped)
+		g_mapped_file_unref(file->mapped);
+	g_array_free(file->line_starts, TRUE);
+	g_free(file->fname);
+	g_free(file);
+}
+
+
+static gboolean get_file_stat(const gchar *utf8_fname, gint64 *mtime, goffset *size)
+{
+	gchar *fname = utils_get_locale_from_utf8(utf8_fname);
+	GStatBuf st;
+	gboolean ret = FALSE;
+
+	if (fname && g_stat(fname, &st) == 0)
+	{
+		*mtime = st.st_mtime;
+		*size = st.st_size;
+		ret = TRUE;
+	}
+
+	g_free(fname);
+	return ret;
+}
+
+
+static LineFile *line_file_new(const gchar *utf8_fname, gint64 mtime, goffset size)
+{
+	gchar *fname = utils_get_locale_from_utf8(utf8_fname);
+	GMappedFile *mapped = fname ? g_mapped_file_new(fname, FALSE, NULL) : NULL;
+	LineFile *file;
+	gsize start = 0;
+
+	g_free(fname);
+	if (!mapped)
+		return NULL;
+
+	file = g_new0(LineFile, 1);
+	file->refcount = 1;
+	g_mutex_init(&file->lock);
+	file->fname = g_strdup(utf8_fname);
+	file->mapped = mapped;
+	file->mtime = mtime;
+	file->size = size;
+	file->line_starts = g_array_new(FALSE, FALSE, sizeof(gsize));
+	g_array_append_val(file->line_starts, start);
+
+	return file;
+}
+
+
+static void lru_remove(GList *link)
+{
+	LineFile *file = link->data;
+
+	g_hash_table_remove(lru_table, file->fname);
+	g_queue_delete_link(&lru, link);
+	line_file_unref(file);
+}
+
+
+/* returns a new reference to the file */
+static LineFile *lru_get(const gchar *utf8_fname)
+{
+	LineFile *file = NULL;
+	gint64 mtime;
+	goffset size;
+	GList *link;
+
+	if (!get_file_stat(utf8_fname, &mtime, &size))
+		return NULL;
+
+	G_LOCK(lru);
+
+	if (!lru_table)
+		lru_table = g_hash_table_new(g_str_hash, g_str_equal);
+
+	link = g_hash_table_lookup(lru_table, utf8_fname);
+	if (link)
+	{
+		file = link->data;
+		if (file->mtime == mtime && file->size == size)
+		{
+			g_queue_unlink(&lru, link);
+			g_queue_push_head_link(&lru, link);
+			g_atomic_int_inc(&file->refcount);
+			G_UNLOCK(lru);
+			return file;
+		}
+
+		/* modified since we read it */
+		lru_remove(link);
+	}
+
+	file = line_file_new(utf8_fname, mtime, size);
+	if (file)
+	{
+		g_queue_push_head(&lru, file);
+		g_hash_table_insert(lru_table, file->fname, lru.head);
+
+		while (lru.length > LINE_READER_CACHE_SIZE)
+			lru_remove(lru.tail);
+
+		g_atomic_int_inc(&file->refcount);
+	}
+
+	G_UNLOCK(lru);
+
+	return file;
+}
+
+
+/* extends the line index until it contains @line or the end of file, lines
+ * end with \n, \r or \r\n */
+static void index_lines(LineFile *file, gint line)
+{
+	const gchar *contents = g_mapped_file_get_contents(file->mapped);
+	gsize len = g_mapped_file_get_length(file->mapped);
+
+	while (file->line_starts->len <= (guint)line && file->scanned < len)
+	{
+		gsize line_len = lsp_utils_skip_line(contents + file->scanned, len - file->scanned);
+		gsize start;
+
+		if (line_len == 0)
+		{
+			file->scanned = len;
+			break;
+		}
+
+		start = file->scanned + line_len;
+		g_array_append_val(file->line_starts, start);
+		file->scanned = start;
+	}
+}
+
+
+/* must be called with file->lock held */
+static gchar *line_file_get_line(LineFile *file, gint line)
+{
+	const gchar *contents;
+	gsize len, start, end;
+
+	if (line < 0)
+		return NULL;
+
+	index_lines(file, line);
+	if ((guint)line >= file->line_starts->len)
+		return NULL;
+
+	contents = g_mapped_file_get_contents(file->mapped);
+	len = g_mapped_file_get_length(file->mapped);
+	start = g_array_index(file->line_starts, gsize, line);
+	if ((guint)line + 1 < file->line_starts->len)
+	{
+		end = g_array_index(file->line_starts, gsize, line + 1) - 1;
+		// the \r of \r\n
+		if (end > start && contents[end] == '\n' && contents[end - 1] == '\r')
+			end--;
+	}
+	else
+	{
+		for (end = start; end < len && contents[end] != '\n' && contents[end] != '\r'; end++)
+			;
+	}
+
+	if (g_utf8_validate(contents + start, end - start, NULL))
+		return g_strndup(contents + start, end - start);
+	return g_utf8_make_valid(contents + start, end - start);
+}
+
+
+/* Stores the requested (0-based) lines without line endings into @ret,
+ * NULL for lines which don't exist. Reading lines in ascending order is
+ * the cheapest. */
+void lsp_line_reader_get_lines(const gchar *utf8_fname, const gint *lines, guint num, gchar **ret)
+{
+	LineFile *file = utf8_fname ? lru_get(utf8_fname) : NULL;
+	guint i;
+
+	if (!file)
+	{
+		for (i = 0; i < num; i++)
+			ret[i] = NULL;
+		return;
+	}
+
+	g_mutex_lock(&file->lock);
+	for (i = 0; i < num; i++)
+		ret[i] = line_file_get_line(file, lines[i]);
+	g_mutex_unlock(&file->lock);
+
+	line_file_unref(file);
+}
+
+
+/* returns the line (0-based) without the line ending or NULL if it doesn't exist */
+gchar *lsp_line_reader_get_line(const gchar *utf8_fname, gint line)
+{
+	gchar *ret;
+
+	lsp_line_reader_get_lines(utf8_fname, &line, 1, &ret);
+	return ret;
+}
+
+
+void lsp_line_reader_clear(void)
+{
+	G_LOCK(lru);
+	g_queue_foreach(&lru, (GFunc)line_file_unref, NULL);
+	g_queue_clear(&lru);
+	if (lru_table)
+		g_hash_table_destroy(lru_table);
+	lru_table = NULL;
+	G_UNLOCK(lru);
+}
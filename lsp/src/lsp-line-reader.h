@@ -0,0 +1,29 @@
+/*
+ * Copyright 2024 Jiri Techet <techet@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef LSP_LINE_READER_H
+#define LSP_LINE_READER_H 1
+
+#include <glib.h>
+
+gchar *lsp_line_reader_get_line(const gchar *utf8_fname, gint line);
+void lsp_line_reader_get_lines(const gchar *utf8_fname, const gint *lines, guint num, gchar **ret);
+
+void lsp_line_reader_clear(void);
+
+#endif  /* LSP_LINE_READER_H */
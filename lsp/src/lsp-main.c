@@ -34,12 +34,16 @@
 #include "lsp-format.h"
 #include "lsp-highlight.h"
 #include "lsp-rename.h"
+#include "lsp-rename-preview.h"
 #include "lsp-command.h"
 #include "lsp-code-lens.h"
 #include "lsp-symbol.h"
 #include "lsp-extension.h"
 #include "lsp-workspace-folders.h"
 #include "lsp-symbol-tree.h"
+#include "lsp-symbol-index.h"
+#include "lsp-line-reader.h"
+#include "lsp-goto-msgwin.h"
 #include "lsp-selection-range.h"
 
 #include <sys/time.h>
@@ -361,8 +365,13 @@ static gboolean on_update_idle(gpointer data)
 	lsp_code_lens_send_request(doc);
 	if (symbol_highlight_provided(doc, NULL))
 		lsp_semtokens_send_request(doc);
-	if (srv->config.document_symbols_enable)
+	// symbols are only needed by the symbol tree here; other users request
+	// them on demand when the cached version is out of date
+	if (srv->config.document_symbols_enable && lsp_symbol_tree_is_visible() &&
+		!lsp_symbols_doc_cache_valid(doc))
+	{
 		lsp_symbols_doc_request(doc, lsp_symbol_request_cb, doc);
+	}
 
 	return G_SOURCE_REMOVE;
 }
@@ -433,7 +442,7 @@ static void on_document_close(G_GNUC_UNUSED GObject * obj, GeanyDocument *doc,
 
 static void stop_and_init_all_servers(void)
 {
-	lsp_server_stop_all(FALSE);
+	lsp_server_stop_all(FALSE, FALSE);
 	session_loaded = FALSE;
 
 	lsp_server_init_all();
@@ -452,6 +461,24 @@ static void restart_all_servers(void)
 }
 
 
+/* restarts only servers whose configuration requires it */
+static void reload_config(const gchar *init_file)
+{
+	GeanyDocument *doc = document_get_current();
+
+	if (lsp_utils_is_lsp_disabled_for_project())
+		stop_and_init_all_servers();
+	else
+	{
+		lsp_server_reload_config(init_file);
+		lsp_symbol_tree_init();
+	}
+
+	if (doc)
+		on_document_visible(doc);
+}
+
+
 static void on_document_save(G_GNUC_UNUSED GObject *obj, GeanyDocument *doc,
 	G_GNUC_UNUSED gpointer user_data)
 {
@@ -459,16 +486,18 @@ static void on_document_save(G_GNUC_UNUSED GObject *obj, GeanyDocument *doc,
 
 	if (g_strcmp0(doc->real_path, lsp_utils_get_config_filename()) == 0)
 	{
-		stop_and_init_all_servers();
+		reload_config(NULL);
 		return;
 	}
 
 	if (lsp_server_uses_init_file(doc->real_path))
 	{
-		stop_and_init_all_servers();
+		reload_config(doc->real_path);
 		return;
 	}
 
+	lsp_symbol_index_update_doc(doc);
+
 	srv = lsp_server_get(doc);
 	if (!srv)
 		return;
@@ -782,7 +811,9 @@ static gboolean on_editor_notify(G_GNUC_UNUSED GObject *obj, GeanyEditor *editor
 			lsp_sync_text_document_did_open(srv, doc);
 		}
 
-		if (nt->modificationType & SC_MOD_INSERTTEXT)  // after insert
+		if (lsp_sync_did_change_suppressed(doc))
+			;  /* sent at once after all the edits are applied */
+		else if (nt->modificationType & SC_MOD_INSERTTEXT)  // after insert
 		{
 			LspPosition pos_start = lsp_utils_scintilla_pos_to_lsp(sci, nt->position);
 			LspPosition pos_end = pos_start;
@@ -885,12 +916,71 @@ static void update_active_config_menuitem(gboolean have_project_config)
 }
 
 
+static void prewarm_server_for_ft(GeanyFiletype *ft, GHashTable *started)
+{
+	if (!ft || g_hash_table_contains(started, ft))
+		return;
+
+	g_hash_table_add(started, ft);
+	// starts the server, documents are opened on it in on_server_initialized()
+	lsp_server_get_for_ft(ft);
+}
+
+
+/* Starts servers for the filetypes of the session files so they initialize
+ * while Geany opens the files instead of after the first document becomes
+ * visible. All the servers start in parallel. */
+static void prewarm_servers(GKeyFile *kf)
+{
+	GHashTable *started = g_hash_table_new(NULL, NULL);
+	gchar **keys = g_key_file_get_keys(kf, "files", NULL, NULL);
+	gchar **key;
+	guint i;
+
+	for (key = keys; key && *key; key++)
+	{
+		gchar *val = g_key_file_get_string(kf, "files", *key, NULL);
+		// position;filetype;readonly;encoding;indent_type;auto_indent;line_wrap;escaped_filename;...
+		gchar **fields = val ? g_strsplit(val, ";", -1) : NULL;
+
+		if (fields && g_strv_length(fields) >= 8)
+		{
+			gchar *locale_fname = g_uri_unescape_string(fields[7], NULL);
+
+			// the same mapping and project rules as for open documents
+			if (locale_fname)
+			{
+				prewarm_server_for_ft(lsp_server_get_ft_for_file(locale_fname,
+					filetypes_lookup_by_name(fields[1])), started);
+			}
+			g_free(locale_fname);
+		}
+
+		g_strfreev(fields);
+		g_free(val);
+	}
+
+	foreach_document(i)
+	{
+		if (lsp_server_is_usable(documents[i]))
+			prewarm_server_for_ft(lsp_server_get_ft(documents[i], NULL), started);
+	}
+
+	g_strfreev(keys);
+	g_hash_table_destroy(started);
+}
+
+
 static void on_project_open(G_GNUC_UNUSED GObject *obj, GKeyFile *kf,
 	G_GNUC_UNUSED gpointer user_data)
 {
 	load_project_config(kf);
 	update_active_config_menuitem(lsp_utils_get_project_config_filename() != NULL);
 	stop_and_init_all_servers();
+	lsp_symbol_index_load();
+
+	if (lsp_server_get_all_section_config()->prewarm_on_project_open)
+		prewarm_servers(kf);
 }
 
 
@@ -903,6 +993,8 @@ static void on_project_close(G_GNUC_UNUSED GObject *obj, G_GNUC_UNUSED gpointer
 
 	update_active_config_menuitem(FALSE);
 
+	lsp_symbol_index_save_and_free();
+
 	stop_and_init_all_servers();
 }
 
@@ -919,7 +1011,7 @@ static void on_project_dialog_confirmed(G_GNUC_UNUSED GObject *obj, GtkWidget *n
 
 	update_active_config_menuitem(lsp_utils_get_project_config_filename() != NULL);
 
-	restart_all_servers();
+	reload_config(NULL);
 }
 
 
@@ -1216,7 +1308,7 @@ static void terminate_all(void)
 	plugin_extension_unregister(&extension);
 	lsp_server_set_initialized_cb(NULL);
 
-	lsp_server_stop_all(TRUE);
+	lsp_server_stop_all(TRUE, geany_quitting);
 }
 
 
@@ -1284,6 +1376,14 @@ static void on_show_initialize_responses(void)
 }
 
 
+static void on_show_server_status(void)
+{
+	gchar *status = lsp_server_get_status();
+	document_new_file(NULL, NULL, status);
+	g_free(status);
+}
+
+
 static void show_hover_popup(void)
 {
 	GeanyDocument *doc = document_get_current();
@@ -1710,6 +1810,10 @@ static void create_menu_items()
 	gtk_container_add(GTK_CONTAINER(menu), item);
 	g_signal_connect(item, "activate", G_CALLBACK(on_show_initialize_responses), NULL);
 
+	item = gtk_menu_item_new_with_mnemonic(_("Server _Status"));
+	gtk_container_add(GTK_CONTAINER(menu), item);
+	g_signal_connect(item, "activate", G_CALLBACK(on_show_server_status), NULL);
+
 	gtk_container_add(GTK_CONTAINER(menu), gtk_separator_menu_item_new());
 
 	item = gtk_menu_item_new_with_mnemonic(_("_Restart All Servers"));
@@ -1802,6 +1906,23 @@ static void on_server_initialized(LspServer *srv)
 				lsp_sync_text_document_did_open(srv, doc);
 		}
 	}
+
+	// after crash, open the documents the previous server had open
+	if (srv->reopen_docs)
+	{
+		gchar *fname;
+
+		foreach_ptr_array(fname, i, srv->reopen_docs)
+		{
+			GeanyDocument *doc = document_find_by_filename(fname);
+
+			if (doc && lsp_server_get_if_running(doc) == srv)
+				lsp_sync_text_document_did_open(srv, doc);
+		}
+
+		g_ptr_array_free(srv->reopen_docs, TRUE);
+		srv->reopen_docs = NULL;
+	}
 }
 
 
@@ -1836,6 +1957,8 @@ void plugin_init(G_GNUC_UNUSED GeanyData * data)
 
 	stop_and_init_all_servers();
 
+	lsp_symbol_index_load();
+
 	plugin_extension_register(&extension, "LSP", 100, NULL);
 
 	create_menu_items();
@@ -1866,6 +1989,13 @@ void plugin_cleanup(void)
 
 	lsp_symbol_tree_destroy();
 	lsp_diagnostics_common_destroy();
+	lsp_symbol_index_save_and_free();
+	lsp_goto_msgwin_destroy();
+	lsp_rename_preview_destroy();
+	lsp_line_reader_clear();
+	lsp_goto_destroy();
+	lsp_goto_anywhere_destroy();
+	lsp_symbol_cleanup();
 }
 
 
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2024 Jiri Techet <techet@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/* Reads resource usage of server processes from /proc, only available
+ * on Linux. */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "lsp-procstat.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+#ifdef __linux__
+
+static gboolean read_status(GPid pid, LspProcStat *stat)
+{
+	gchar *path = g_strdup_printf("/proc/%d/status", (gint)pid);
+	gchar *contents = NULL;
+	gboolean found_rss = FALSE;
+
+	if (g_file_get_contents(path, &contents, NULL, NULL))
+	{
+		gchar **lines = g_strsplit(contents, "\n", -1);
+		gchar **line;
+
+		for (line = lines; *line; line++)
+		{
+			// values in kB
+			if (g_str_has_prefix(*line, "VmRSS:"))
+			{
+				stat->rss_kb = g_ascii_strtoull(*line + strlen("VmRSS:"), NULL, 10);
+				found_rss = TRUE;
+			}
+			else if (g_str_has_prefix(*line, "Threads:"))
+				stat->threads = atoi(*line + strlen("Threads:"));
+		}
+
+		g_strfreev(lines);
+	}
+
+	g_free(contents);
+	g_free(path);
+
+	return found_rss;
+}
+
+
+static gboolean read_stat(GPid pid, LspProcStat *stat)
+{
+	gchar *path = g_strdup_printf("/proc/%d/stat", (gint)pid);
+	gchar *contents = NULL;
+	gboolean success = FALSE;
+
+	if (g_file_get_contents(path, &contents, NULL, NULL))
+	{
+		// the command name in parentheses may contain spaces, skip it
+		gchar *pos = strrchr(contents, ')');
+		gchar **fields = g_strsplit(pos ? pos + 1 : "", " ", -1);
+
+		// the string starts with a space before the state (field 3) so field
+		// N is at index N - 2; utime and stime are fields 14 and 15
+		if (g_strv_length(fields) > 13)
+		{
+			guint64 ticks = g_ascii_strtoull(fields[12], NULL, 10) +
+				g_ascii_strtoull(fields[13], NULL, 10);
+			glong ticks_per_sec = sysconf(_SC_CLK_TCK);
+
+			if (ticks_per_sec > 0)
+			{
+				stat->cpu_ms = ticks * 1000 / ticks_per_sec;
+				success = TRUE;
+			}
+		}
+
+		g_strfreev(fields);
+	}
+
+	g_free(contents);
+	g_free(path);
+
+	return success;
+}
+
+#endif
+
+
+gboolean lsp_procstat_read(GPid pid, LspProcStat *stat)
+{
+	memset(stat, 0, sizeof(LspProcStat));
+
+#ifdef __linux__
+	if (pid > 0)
+		return read_status(pid, stat) && read_stat(pid, stat);
+#endif
+
+	return FALSE;
+}
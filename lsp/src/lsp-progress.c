@@ -32,6 +32,14 @@ typedef struct
 } LspProgress;
 
 
+typedef struct
+{
+	gchar *token;
+	LspPartialResultCallback callback;
+	gpointer user_data;
+} LspPartialResult;
+
+
 static gint progress_num = 0;
 
 
@@ -56,6 +64,71 @@ void lsp_progress_create(LspServer *server, LspProgressToken token)
 }
 
 
+/* returns the partialResultToken the server uses in $/progress notifications
+ * carrying parts of the result */
+const gchar *lsp_progress_partial_result_new(LspServer *server, LspPartialResultCallback callback,
+	gpointer user_data)
+{
+	static guint partial_result_num = 0;
+	LspPartialResult *r = g_new0(LspPartialResult, 1);
+
+	r->token = g_strdup_printf("geany_partial_result_%u", ++partial_result_num);
+	r->callback = callback;
+	r->user_data = user_data;
+
+	server->partial_results = g_slist_prepend(server->partial_results, r);
+
+	return r->token;
+}
+
+
+static void partial_result_free(LspPartialResult *r)
+{
+	g_free(r->token);
+	g_free(r);
+}
+
+
+void lsp_progress_partial_result_free(LspServer *server, const gchar *token)
+{
+	GSList *node;
+
+	foreach_slist(node, server->partial_results)
+	{
+		LspPartialResult *r = node->data;
+		if (g_strcmp0(r->token, token) == 0)
+		{
+			server->partial_results = g_slist_remove_link(server->partial_results, node);
+			g_slist_free_full(node, (GDestroyNotify)partial_result_free);
+			break;
+		}
+	}
+}
+
+
+static gboolean process_partial_result(LspServer *server, const gchar *token, GVariant *params)
+{
+	GVariant *value = NULL;
+	GSList *node;
+
+	foreach_slist(node, server->partial_results)
+	{
+		LspPartialResult *r = node->data;
+		if (g_strcmp0(r->token, token) == 0)
+		{
+			if (JSONRPC_MESSAGE_PARSE(params, "value", JSONRPC_MESSAGE_GET_VARIANT(&value)))
+			{
+				r->callback(value, r->user_data);
+				g_variant_unref(value);
+			}
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+
 static gboolean token_equal(LspProgressToken t1, LspProgressToken t2)
 {
 	if (t1.token_str != NULL || t2.token_str != NULL)
@@ -136,6 +209,8 @@ void lsp_progress_free_all(LspServer *server)
 
 	g_slist_free_full(server->progress_ops, (GDestroyNotify)progress_free);
 	server->progress_ops = 0;
+	g_slist_free_full(server->partial_results, (GDestroyNotify)partial_result_free);
+	server->partial_results = NULL;
 	progress_num = MAX(0, progress_num - len);
 	if (progress_num == 0)
 		ui_progress_bar_stop();
@@ -161,6 +236,9 @@ void lsp_progress_process_notification(LspServer *srv, GVariant *params)
 			"token", JSONRPC_MESSAGE_GET_INT64(&token_int)
 		);
 	}
+	if (srv && token_str && process_partial_result(srv, token_str, params))
+		return;
+
 	JSONRPC_MESSAGE_PARSE(params,
 		"value", "{",
 			"kind", JSONRPC_MESSAGE_GET_STRING(&kind),
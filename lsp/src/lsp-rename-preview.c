@@ -0,0 +1,694 @@
+/*
+ * Copyright 2024 Jiri Techet <techet@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/* Shows the files affected by a rename before the edits are applied. Only
+ * the number of edits is shown for every file initially, the edited lines
+ * are read when the file row is expanded. Open documents are edited from
+ * idle callbacks and the remaining files are written by a background
+ * thread. */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "lsp-rename-preview.h"
+#include "lsp-line-reader.h"
+#include "lsp-text-edit.h"
+#include "lsp-sync.h"
+#include "lsp-utils.h"
+
+#include <jsonrpc-glib.h>
+#include <string.h>
+
+
+#define APPLY_BATCH_SIZE 20
+
+
+enum
+{
+	COL_INCLUDE,
+	COL_TEXT,
+	COL_FILE,
+	COL_IS_FILE,
+	N_COLS
+};
+
+
+typedef struct
+{
+	gchar *uri;
+	gchar *fname;  // utf8
+	GVariant *edits;  // unparsed array of TextEdits
+	guint num_edits;
+	gint64 version;  // document version the edits were computed for, -1 if unknown
+	gboolean include;
+	gboolean loaded;
+} PreviewFile;
+
+
+extern GeanyData *geany_data;
+
+static struct
+{
+	GtkWidget *dialog;
+	GtkWidget *summary_label;
+	GtkWidget *tree;
+	GtkTreeStore *store;
+	GPtrArray *files;
+	GCallback on_done;
+
+	GQueue apply_queue;
+	GPtrArray *file_edits;
+	GThread *thread;
+} preview = {NULL, NULL, NULL, NULL, NULL, NULL, G_QUEUE_INIT, NULL, NULL};
+
+
+static void preview_file_free(PreviewFile *file)
+{
+	g_free(file->uri);
+	g_free(file->fname);
+	g_variant_unref(file->edits);
+	g_free(file);
+}
+
+
+static gint sort_files(gconstpointer a, gconstpointer b)
+{
+	PreviewFile *f1 = *((PreviewFile **)a);
+	PreviewFile *f2 = *((PreviewFile **)b);
+
+	return g_strcmp0(f1->fname, f2->fname);
+}
+
+
+static PreviewFile *preview_file_new(const gchar *uri, GVariant *edits, gint64 version)
+{
+	PreviewFile *file;
+	gchar *fname = lsp_utils_get_real_path_from_uri_utf8(uri);
+
+	if (!fname)
+		return NULL;
+
+	file = g_new0(PreviewFile, 1);
+	file->uri = g_strdup(uri);
+	file->fname = fname;
+	file->edits = g_variant_ref(edits);
+	file->num_edits = g_variant_n_children(edits);
+	file->version = version;
+	file->include = TRUE;
+
+	if (file->version < 0)
+	{
+		GeanyDocument *doc = document_find_by_filename(fname);
+
+		if (doc)
+			file->version = lsp_sync_get_doc_version(doc);
+	}
+
+	return file;
+}
+
+
+/* Returns files with text edits in the workspace edit or NULL if it contains
+ * something we cannot preview, like resource operations. */
+static GPtrArray *collect_files(GVariant *workspace_edit)
+{
+	GPtrArray *files = g_ptr_array_new_full(0, (GDestroyNotify)preview_file_free);
+	GHashTable *uris = g_hash_table_new(g_str_hash, g_str_equal);
+	GVariant *document_changes = NULL;
+	GVariant *changes = NULL;
+	gboolean ok = TRUE;
+
+	JSONRPC_MESSAGE_PARSE(workspace_edit,
+		"documentChanges", JSONRPC_MESSAGE_GET_VARIANT(&document_changes)
+		);
+	JSONRPC_MESSAGE_PARSE(workspace_edit,
+		"changes", JSONRPC_MESSAGE_GET_VARIANT(&changes)
+		);
+
+	if (document_changes && g_variant_is_of_type(document_changes, G_VARIANT_TYPE("av")))
+	{
+		GVariant *change;
+		GVariantIter iter;
+
+		g_variant_iter_init(&iter, document_changes);
+		while (ok && (change = g_variant_iter_next_value(&iter)))
+		{
+			GVariant *unboxed = g_variant_get_variant(change);
+			GVariant *text_document = NULL;
+			GVariant *edits = NULL;
+			const gchar *uri = NULL;
+			gint64 version = -1;
+
+			JSONRPC_MESSAGE_PARSE(unboxed,
+				"textDocument", JSONRPC_MESSAGE_GET_VARIANT(&text_document),
+				"edits", JSONRPC_MESSAGE_GET_VARIANT(&edits)
+			);
+
+			if (text_document)
+			{
+				JSONRPC_MESSAGE_PARSE(text_document, "uri", JSONRPC_MESSAGE_GET_STRING(&uri));
+				JSONRPC_MESSAGE_PARSE(text_document, "version", JSONRPC_MESSAGE_GET_INT64(&version));
+			}
+
+			// several edits of the same file have to be applied one after another
+			ok = uri && edits && !g_hash_table_contains(uris, uri);
+			if (ok)
+			{
+				PreviewFile *file = preview_file_new(uri, edits, version);
+
+				if (file)
+				{
+					g_ptr_array_add(files, file);
+					g_hash_table_add(uris, file->uri);
+				}
+			}
+
+			if (edits)
+				g_variant_unref(edits);
+			if (text_document)
+				g_variant_unref(text_document);
+			g_variant_unref(unboxed);
+			g_variant_unref(change);
+		}
+	}
+	else if (changes && g_variant_is_of_type(changes, G_VARIANT_TYPE_DICTIONARY))
+	{
+		GVariantIter iter;
+		GVariant *text_edits;
+		gchar *uri;
+
+		g_variant_iter_init(&iter, changes);
+		while (g_variant_iter_loop(&iter, "{sv}", &uri, &text_edits))
+		{
+			PreviewFile *file = preview_file_new(uri, text_edits, -1);
+
+			if (file)
+				g_ptr_array_add(files, file);
+		}
+	}
+
+	if (document_changes)
+		g_variant_unref(document_changes);
+	if (changes)
+		g_variant_unref(changes);
+	g_hash_table_destroy(uris);
+
+	if (!ok)
+	{
+		g_ptr_array_free(files, TRUE);
+		return NULL;
+	}
+
+	g_ptr_array_sort(files, sort_files);
+
+	return files;
+}
+
+
+static GPtrArray *parse_edits(PreviewFile *file)
+{
+	GVariantIter iter;
+
+	g_variant_iter_init(&iter, file->edits);
+	return lsp_utils_parse_text_edits(&iter);
+}
+
+
+static void update_summary(void)
+{
+	PreviewFile *file;
+	guint num_files = 0;
+	guint num_edits = 0;
+	gchar *text;
+	guint i;
+
+	foreach_ptr_array(file, i, preview.files)
+	{
+		if (file->include)
+		{
+			num_files++;
+			num_edits += file->num_edits;
+		}
+	}
+
+	text = g_strdup_printf(_("%u edits in %u files"), num_edits, num_files);
+	gtk_label_set_text(GTK_LABEL(preview.summary_label), text);
+	g_free(text);
+
+	gtk_dialog_set_response_sensitive(GTK_DIALOG(preview.dialog), GTK_RESPONSE_ACCEPT,
+		num_files > 0);
+}
+
+
+/* the edited lines of the file, only read when the file is expanded */
+static void load_file_diff(PreviewFile *file, GtkTreeIter *parent)
+{
+	GeanyDocument *doc = document_find_by_filename(file->fname);
+	GPtrArray *edits = parse_edits(file);
+	GArray *lines = g_array_new(FALSE, FALSE, sizeof(gint));
+	gchar **texts;
+	GtkTreeIter placeholder;
+	GtkTreeIter iter;
+	LspTextEdit *e;
+	guint i, j;
+
+	g_ptr_array_sort(edits, lsp_text_edit_cmp);
+
+	foreach_ptr_array(e, i, edits)
+	{
+		gint line = e->range.start.line;
+
+		if (lines->len == 0 || g_array_index(lines, gint, lines->len - 1) != line)
+			g_array_append_val(lines, line);
+	}
+
+	texts = g_new0(gchar *, lines->len);
+	if (doc)
+	{
+		for (i = 0; i < lines->len; i++)
+			texts[i] = sci_get_line(doc->editor->sci, g_array_index(lines, gint, i));
+	}
+	else
+		lsp_line_reader_get_lines(file->fname, (gint *)(gpointer)lines->data, lines->len, texts);
+
+	j = 0;
+	for (i = 0; i < lines->len; i++)
+	{
+		gint line = g_array_index(lines, gint, i);
+		const gchar *old_text = texts[i] ? g_strchomp(texts[i]) : "";
+		GArray *line_edits = g_array_new(FALSE, FALSE, sizeof(LspTextEdit));
+		GPtrArray *line_edit_ptrs = g_ptr_array_new();
+		gchar *new_text;
+		gchar *markup;
+		gsize len;
+		guint k;
+
+		// edits relative to the line, edits spanning more lines replace the rest of the line
+		for (; j < edits->len && ((LspTextEdit *)edits->pdata[j])->range.start.line == line; j++)
+		{
+			LspTextEdit edit = *((LspTextEdit *)edits->pdata[j]);
+
+			edit.range.start.line = 0;
+			edit.range.end.line -= line;
+			g_array_append_val(line_edits, edit);
+		}
+		for (k = 0; k < line_edits->len; k++)
+			g_ptr_array_add(line_edit_ptrs, &g_array_index(line_edits, LspTextEdit, k));
+
+		new_text = lsp_text_edit_apply(old_text, strlen(old_text), line_edit_ptrs, &len);
+
+		markup = g_markup_printf_escaped("%d:  - %s\n%d:  + %s", line + 1, old_text,
+			line + 1, new_text);
+		gtk_tree_store_append(preview.store, &iter, parent);
+		gtk_tree_store_set(preview.store, &iter,
+			COL_TEXT, markup,
+			COL_IS_FILE, FALSE,
+			-1);
+
+		g_free(markup);
+		g_free(new_text);
+		g_ptr_array_free(line_edit_ptrs, TRUE);
+		g_array_free(line_edits, TRUE);
+	}
+
+	if (gtk_tree_model_iter_children(GTK_TREE_MODEL(preview.store), &placeholder, parent))
+		gtk_tree_store_remove(preview.store, &placeholder);
+
+	for (i = 0; i < lines->len; i++)
+		g_free(texts[i]);
+	g_free(texts);
+	g_array_free(lines, TRUE);
+	g_ptr_array_free(edits, TRUE);
+}
+
+
+static gboolean on_test_expand_row(GtkTreeView *tree_view, GtkTreeIter *iter, GtkTreePath *path,
+	gpointer user_data)
+{
+	PreviewFile *file = NULL;
+
+	gtk_tree_model_get(GTK_TREE_MODEL(preview.store), iter, COL_FILE, &file, -1);
+
+	if (file && !file->loaded)
+	{
+		load_file_diff(file, iter);
+		file->loaded = TRUE;
+	}
+
+	return FALSE;
+}
+
+
+static void on_include_toggled(GtkCellRendererToggle *renderer, gchar *path_str, gpointer user_data)
+{
+	GtkTreeModel *model = GTK_TREE_MODEL(preview.store);
+	PreviewFile *file = NULL;
+	GtkTreeIter iter;
+
+	if (!gtk_tree_model_get_iter_from_string(model, &iter, path_str))
+		return;
+
+	gtk_tree_model_get(model, &iter, COL_FILE, &file, -1);
+	if (!file)
+		return;
+
+	file->include = !file->include;
+	gtk_tree_store_set(preview.store, &iter, COL_INCLUDE, file->include, -1);
+
+	update_summary();
+}
+
+
+static void free_preview(void)
+{
+	if (preview.dialog)
+		gtk_widget_destroy(preview.dialog);
+	preview.dialog = NULL;
+	preview.summary_label = NULL;
+	preview.tree = NULL;
+	preview.store = NULL;
+
+	g_queue_clear(&preview.apply_queue);
+
+	if (preview.file_edits)
+		g_ptr_array_free(preview.file_edits, TRUE);
+	preview.file_edits = NULL;
+
+	if (preview.files)
+		g_ptr_array_free(preview.files, TRUE);
+	preview.files = NULL;
+
+	preview.on_done = NULL;
+}
+
+
+static gboolean apply_finished(gpointer user_data)
+{
+	GCallback on_done = preview.on_done;
+	LspFileEdits *fe;
+	guint i;
+
+	if (preview.thread)
+		g_thread_join(preview.thread);
+	preview.thread = NULL;
+
+	foreach_ptr_array(fe, i, preview.file_edits)
+	{
+		if (fe->error)
+			msgwin_status_add(_("Failed to apply edits to %s: %s"), fe->fname, fe->error->message);
+	}
+
+	free_preview();
+
+	if (on_done)
+		on_done();
+
+	return G_SOURCE_REMOVE;
+}
+
+
+static gpointer apply_thread(gpointer data)
+{
+	lsp_text_edit_apply_to_files(preview.file_edits);
+
+	g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, apply_finished, &preview, NULL);
+
+	return NULL;
+}
+
+
+/* open documents are edited in batches so the UI stays responsive, the
+ * remaining files are written by a background thread at the end */
+static gboolean apply_batch(gpointer user_data)
+{
+	PreviewFile *file;
+	guint count = 0;
+
+	while (count < APPLY_BATCH_SIZE && (file = g_queue_pop_head(&preview.apply_queue)))
+	{
+		GeanyDocument *doc = document_find_by_filename(file->fname);
+		GPtrArray *edits = parse_edits(file);
+
+		if (doc)
+		{
+			ScintillaObject *sci = doc->editor->sci;
+
+			sci_start_undo_action(sci);
+			lsp_utils_apply_text_edits(sci, NULL, edits, FALSE);
+			sci_end_undo_action(sci);
+			g_ptr_array_free(edits, TRUE);
+			count++;
+		}
+		else
+		{
+			gchar *fname_locale = utils_get_locale_from_utf8(file->fname);
+			LspFileEdits *fe = lsp_text_edit_file_edits_new(file->fname, fname_locale);
+
+			g_ptr_array_add(fe->edits, edits);
+			g_ptr_array_add(preview.file_edits, fe);
+			g_free(fname_locale);
+		}
+	}
+
+	if (!g_queue_is_empty(&preview.apply_queue))
+		return G_SOURCE_CONTINUE;
+
+	if (preview.file_edits->len > 0)
+		preview.thread = g_thread_new("lsp-rename", apply_thread, NULL);
+	else
+		apply_finished(NULL);
+
+	return G_SOURCE_REMOVE;
+}
+
+
+/* the server computed the edits against specific versions of the documents,
+ * refuse the whole rename when any of them changed in the meantime */
+static gboolean document_versions_match(void)
+{
+	PreviewFile *file;
+	guint i;
+
+	foreach_ptr_array(file, i, preview.files)
+	{
+		GeanyDocument *doc;
+
+		if (!file->include || file->version < 0)
+			continue;
+
+		doc = document_find_by_filename(file->fname);
+		if (doc && lsp_sync_get_doc_version(doc) != file->version)
+		{
+			msgwin_status_add(_("Rename refused because %s has changed"), file->fname);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+
+static void start_apply(void)
+{
+	PreviewFile *file;
+	guint i;
+
+	if (!document_versions_match())
+	{
+		free_preview();
+		return;
+	}
+
+	// documents must not change between the batches
+	gtk_window_set_modal(GTK_WINDOW(preview.dialog), TRUE);
+	gtk_widget_set_sensitive(preview.tree, FALSE);
+	gtk_dialog_set_response_sensitive(GTK_DIALOG(preview.dialog), GTK_RESPONSE_ACCEPT, FALSE);
+	gtk_dialog_set_response_sensitive(GTK_DIALOG(preview.dialog), GTK_RESPONSE_CANCEL, FALSE);
+	gtk_label_set_text(GTK_LABEL(preview.summary_label), _("Applying changes..."));
+
+	foreach_ptr_array(file, i, preview.files)
+	{
+		if (file->include)
+			g_queue_push_tail(&preview.apply_queue, file);
+	}
+
+	preview.file_edits = g_ptr_array_new_full(0, (GDestroyNotify)lsp_text_edit_file_edits_free);
+
+	g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, apply_batch, &preview, NULL);
+}
+
+
+static void on_response(GtkDialog *dialog, gint response_id, gpointer user_data)
+{
+	if (preview.file_edits)  // already applying
+		return;
+
+	if (response_id == GTK_RESPONSE_ACCEPT)
+		start_apply();
+	else
+		free_preview();
+}
+
+
+static gboolean on_delete_event(GtkWidget *widget, GdkEvent *event, gpointer user_data)
+{
+	// the dialog is destroyed when applying finishes
+	return preview.file_edits != NULL;
+}
+
+
+static void create_dialog(void)
+{
+	GtkWidget *vbox, *label, *scrolled;
+	GtkCellRenderer *renderer;
+	GtkTreeViewColumn *column;
+
+	preview.dialog = gtk_dialog_new_with_buttons(
+		_("Rename Preview"), GTK_WINDOW(geany->main_widgets->window),
+		GTK_DIALOG_DESTROY_WITH_PARENT,
+		_("_Cancel"), GTK_RESPONSE_CANCEL,
+		_("_Apply"), GTK_RESPONSE_ACCEPT, NULL);
+	gtk_window_set_default_size(GTK_WINDOW(preview.dialog), 700, 500);
+	gtk_dialog_set_default_response(GTK_DIALOG(preview.dialog), GTK_RESPONSE_CANCEL);
+
+	vbox = ui_dialog_vbox_new(GTK_DIALOG(preview.dialog));
+	gtk_box_set_spacing(GTK_BOX(vbox), 6);
+
+	label = gtk_label_new(_("Review the changes and uncheck the files which should not be modified."));
+	gtk_label_set_xalign(GTK_LABEL(label), 0.0);
+	gtk_label_set_line_wrap(GTK_LABEL(label), TRUE);
+	gtk_box_pack_start(GTK_BOX(vbox), label, FALSE, FALSE, 0);
+
+	preview.store = gtk_tree_store_new(N_COLS, G_TYPE_BOOLEAN, G_TYPE_STRING, G_TYPE_POINTER,
+		G_TYPE_BOOLEAN);
+	preview.tree = gtk_tree_view_new_with_model(GTK_TREE_MODEL(preview.store));
+	g_object_unref(preview.store);
+	gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(preview.tree), FALSE);
+
+	column = gtk_tree_view_column_new();
+
+	renderer = gtk_cell_renderer_toggle_new();
+	gtk_tree_view_column_pack_start(column, renderer, FALSE);
+	gtk_tree_view_column_set_attributes(column, renderer,
+		"active", COL_INCLUDE,
+		"visible", COL_IS_FILE,
+		NULL);
+	g_signal_connect(renderer, "toggled", G_CALLBACK(on_include_toggled), NULL);
+
+	renderer = gtk_cell_renderer_text_new();
+	gtk_tree_view_column_pack_start(column, renderer, TRUE);
+	gtk_tree_view_column_set_attributes(column, renderer, "markup", COL_TEXT, NULL);
+
+	gtk_tree_view_append_column(GTK_TREE_VIEW(preview.tree), column);
+
+	g_signal_connect(preview.tree, "test-expand-row", G_CALLBACK(on_test_expand_row), NULL);
+
+	scrolled = gtk_scrolled_window_new(NULL, NULL);
+	gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled),
+		GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+	gtk_scrolled_window_set_shadow_type(GTK_SCROLLED_WINDOW(scrolled), GTK_SHADOW_IN);
+	gtk_container_add(GTK_CONTAINER(scrolled), preview.tree);
+	gtk_box_pack_start(GTK_BOX(vbox), scrolled, TRUE, TRUE, 0);
+
+	preview.summary_label = gtk_label_new(NULL);
+	gtk_label_set_xalign(GTK_LABEL(preview.summary_label), 0.0);
+	gtk_box_pack_start(GTK_BOX(vbox), preview.summary_label, FALSE, FALSE, 0);
+
+	g_signal_connect(preview.dialog, "response", G_CALLBACK(on_response), NULL);
+	g_signal_connect(preview.dialog, "delete-event", G_CALLBACK(on_delete_event), NULL);
+
+	gtk_widget_show_all(preview.dialog);
+}
+
+
+static void fill_store(void)
+{
+	gchar *base_path = lsp_utils_get_project_base_path();
+	PreviewFile *file;
+	guint i;
+
+	foreach_ptr_array(file, i, preview.files)
+	{
+		gchar *rel_path = base_path ? lsp_utils_get_relative_path(base_path, file->fname) : NULL;
+		const gchar *name = rel_path && !g_str_has_prefix(rel_path, "..") ? rel_path : file->fname;
+		gchar *markup = g_markup_printf_escaped("<b>%s</b> (%u)", name, file->num_edits);
+		GtkTreeIter iter, child;
+
+		gtk_tree_store_insert_with_values(preview.store, &iter, NULL, -1,
+			COL_INCLUDE, TRUE,
+			COL_TEXT, markup,
+			COL_FILE, file,
+			COL_IS_FILE, TRUE,
+			-1);
+		// placeholder making the row expandable, replaced in on_test_expand_row()
+		gtk_tree_store_insert_with_values(preview.store, &child, &iter, -1,
+			COL_IS_FILE, FALSE,
+			-1);
+
+		g_free(markup);
+		g_free(rel_path);
+	}
+
+	g_free(base_path);
+}
+
+
+/* Shows the preview of the workspace edit and applies it when confirmed.
+ * Returns FALSE when the edit cannot be previewed. */
+/* a previous rename is still being applied, possibly by the background thread */
+gboolean lsp_rename_preview_is_busy(void)
+{
+	return preview.file_edits != NULL;
+}
+
+
+gboolean lsp_rename_preview_show(GVariant *workspace_edit, GCallback on_done)
+{
+	GPtrArray *files;
+
+	g_return_val_if_fail(!lsp_rename_preview_is_busy(), FALSE);
+
+	files = collect_files(workspace_edit);
+	if (!files)
+		return FALSE;
+
+	free_preview();
+
+	preview.files = files;
+	preview.on_done = on_done;
+
+	create_dialog();
+	fill_store();
+	update_summary();
+
+	return TRUE;
+}
+
+
+void lsp_rename_preview_destroy(void)
+{
+	if (preview.thread)
+		g_thread_join(preview.thread);
+	preview.thread = NULL;
+
+	while (g_source_remove_by_user_data(&preview))
+		;
+
+	free_preview();
+}
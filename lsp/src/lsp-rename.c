@@ -21,6 +21,7 @@
 #endif
 
 #include "lsp-rename.h"
+#include "lsp-rename-preview.h"
 #include "lsp-utils.h"
 #include "lsp-rpc.h"
 
@@ -67,7 +68,7 @@ static gchar *show_dialog_rename(const gchar *old_name)
 		gtk_label_set_use_markup(GTK_LABEL(label), TRUE);
 		gtk_box_pack_start(GTK_BOX(vbox), label, TRUE, FALSE, 0);
 
-		label = gtk_label_new(_("By pressing the <i>Rename</i> button below, you are going to replace <i>Old name</i> with <i>New name</i> <b>in the whole project</b>. There is no further confirmation or change review after this step."));
+		label = gtk_label_new(_("By pressing the <i>Rename</i> button below, you are going to replace <i>Old name</i> with <i>New name</i> <b>in the whole project</b>. The affected files are shown for review before the changes are applied."));
 		gtk_label_set_xalign(GTK_LABEL(label), 0.0);
 		gtk_label_set_use_markup(GTK_LABEL(label), TRUE);
 		gtk_label_set_line_wrap(GTK_LABEL(label), TRUE);
@@ -177,7 +178,12 @@ static void rename_cb(GVariant *return_value, GError *error, gpointer user_data)
 	{
 		//printf("%s\n\n\n", lsp_utils_json_pretty_print(return_value));
 
-		if (lsp_utils_apply_workspace_edit(return_value))
+		/* files of the previous rename may still be written */
+		if (lsp_rename_preview_is_busy())
+			msgwin_status_add(_("Rename already in progress"));
+		/* with a preview, edits are applied after confirmation */
+		else if (!lsp_rename_preview_show(return_value, on_rename_done) &&
+			lsp_utils_apply_workspace_edit(return_value))
 			on_rename_done();
 	}
 	else
@@ -39,6 +39,10 @@ typedef struct
 	LspRpcCallback callback;
 	GDateTime *req_time;
 	gboolean cb_on_startup_shutdown;
+	GCancellable *cancellable;
+	gulong cancel_handler;
+	JsonrpcClient *client;
+	GVariant *id;
 } CallbackData;
 
 
@@ -468,6 +472,21 @@ static void call_cb(GObject *source_object, GAsyncResult *res, gpointer user_dat
 		is_startup_shutdown = srv->startup_shutdown;
 	}
 
+	if (data->cancellable)
+	{
+		g_cancellable_disconnect(data->cancellable, data->cancel_handler);
+
+		// whatever the server returned is not interesting any more
+		if (g_cancellable_is_cancelled(data->cancellable))
+		{
+			g_clear_pointer(&return_value, g_variant_unref);
+			g_clear_error(&error);
+			g_set_error_literal(&error, G_IO_ERROR, G_IO_ERROR_CANCELLED, "Request cancelled");
+		}
+		g_object_unref(data->cancellable);
+		g_variant_unref(data->id);
+	}
+
 	if (data->callback && (!is_startup_shutdown || data->cb_on_startup_shutdown))
 		data->callback(return_value, error, data->user_data);
 
@@ -483,8 +502,28 @@ static void call_cb(GObject *source_object, GAsyncResult *res, gpointer user_dat
 }
 
 
+static void on_call_cancelled(GCancellable *cancellable, gpointer user_data)
+{
+	CallbackData *data = user_data;
+	LspServer *srv = g_hash_table_lookup(client_table, data->client);
+	GVariant *node;
+
+	if (!srv)
+		return;
+
+	node = JSONRPC_MESSAGE_NEW (
+		"id", JSONRPC_MESSAGE_PUT_VARIANT(data->id)
+	);
+
+	lsp_rpc_notify(srv, "$/cancelRequest", node, NULL, NULL);
+
+	g_variant_unref(node);
+}
+
+
 static void call_full(LspServer *srv, const gchar *method, GVariant *params,
-	LspRpcCallback callback, gboolean cb_on_startup_shutdown, gpointer user_data)
+	LspRpcCallback callback, gboolean cb_on_startup_shutdown, GCancellable *cancellable,
+	gpointer user_data)
 {
 	CallbackData *data = g_new0(CallbackData, 1);
 
@@ -496,21 +535,44 @@ static void call_full(LspServer *srv, const gchar *method, GVariant *params,
 
 	lsp_log(srv->log, LspLogClientMessageSent, method, params, NULL, NULL);
 
-	jsonrpc_client_call_async(srv->rpc->client, method, params, NULL, call_cb, data);
+	if (cancellable)
+	{
+		/* the cancellable isn't passed to jsonrpc-glib because interrupting
+		 * the write could leave a partial message in the stream - the server
+		 * is asked to cancel the request instead and its reply is dropped */
+		data->cancellable = g_object_ref(cancellable);
+		data->client = srv->rpc->client;
+		jsonrpc_client_call_with_id_async(srv->rpc->client, method, params, &data->id,
+			NULL, call_cb, data);
+		if (data->id)
+			data->cancel_handler = g_cancellable_connect(cancellable,
+				G_CALLBACK(on_call_cancelled), data, NULL);
+		else
+			data->id = g_variant_take_ref(g_variant_new_int64(0));
+	}
+	else
+		jsonrpc_client_call_async(srv->rpc->client, method, params, NULL, call_cb, data);
 }
 
 
 void lsp_rpc_call(LspServer *srv, const gchar *method, GVariant *params,
 	LspRpcCallback callback, gpointer user_data)
 {
-	call_full(srv, method, params, callback, FALSE, user_data);
+	call_full(srv, method, params, callback, FALSE, NULL, user_data);
+}
+
+
+void lsp_rpc_call_cancellable(LspServer *srv, const gchar *method, GVariant *params,
+	GCancellable *cancellable, LspRpcCallback callback, gpointer user_data)
+{
+	call_full(srv, method, params, callback, FALSE, cancellable, user_data);
 }
 
 
 void lsp_rpc_call_startup_shutdown(LspServer *srv, const gchar *method, GVariant *params,
 	LspRpcCallback callback, gpointer user_data)
 {
-	call_full(srv, method, params, callback, TRUE, user_data);
+	call_full(srv, method, params, callback, TRUE, NULL, user_data);
 }
 
 
@@ -572,6 +634,16 @@ void lsp_rpc_notify(LspServer *srv, const gchar *method, GVariant *params,
 }
 
 
+static void handle_failed(JsonrpcClient *client, gpointer user_data)
+{
+	LspServer *srv = g_hash_table_lookup(client_table, client);
+
+	// NULL after lsp_rpc_destroy()
+	if (srv)
+		lsp_server_connection_failed(srv);
+}
+
+
 LspRpc *lsp_rpc_new(LspServer *srv, GIOStream *stream)
 {
 	LspRpc *c = g_new0(LspRpc, 1);
@@ -583,6 +655,7 @@ LspRpc *lsp_rpc_new(LspServer *srv, GIOStream *stream)
 	g_hash_table_insert(client_table, c->client, srv);
 	g_signal_connect(c->client, "handle-call", G_CALLBACK(handle_call), NULL);
 	g_signal_connect(c->client, "notification", G_CALLBACK(handle_notification), NULL);
+	g_signal_connect(c->client, "failed", G_CALLBACK(handle_failed), NULL);
 	jsonrpc_client_start_listening(c->client);
 
 	return c;
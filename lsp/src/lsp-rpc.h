@@ -36,6 +36,9 @@ void lsp_rpc_destroy(LspRpc *rpc);
 void lsp_rpc_call(LspServer *srv, const gchar *method, GVariant *params,
 	LspRpcCallback callback, gpointer user_data);
 
+void lsp_rpc_call_cancellable(LspServer *srv, const gchar *method, GVariant *params,
+	GCancellable *cancellable, LspRpcCallback callback, gpointer user_data);
+
 void lsp_rpc_call_startup_shutdown(LspServer *srv, const gchar *method, GVariant *params,
 	LspRpcCallback callback, gpointer user_data);
 
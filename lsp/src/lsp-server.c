@@ -28,6 +28,7 @@
 #include "lsp-log.h"
 #include "lsp-semtokens.h"
 #include "lsp-progress.h"
+#include "lsp-procstat.h"
 #include "lsp-symbols.h"
 #include "lsp-symbol-kinds.h"
 #include "lsp-highlight.h"
@@ -40,16 +41,34 @@
 #ifdef G_OS_UNIX
 # include <gio/gunixinputstream.h>
 # include <gio/gunixoutputstream.h>
+# include <gio/gunixsocketaddress.h>
 #else
 # include "spawn/lspunixinputstream.h"
 # include "spawn/lspunixoutputstream.h"
 #endif
 
 #include <unistd.h>
+#ifdef G_OS_UNIX
+# include <signal.h>
+#endif
+#ifdef __linux__
+# include <fcntl.h>
+# ifndef F_SETPIPE_SZ
+#  define F_SETPIPE_SZ 1031  // only defined with _GNU_SOURCE
+# endif
+#endif
 
 #define CACHED_FILETYPE_KEY "lsp_server_cached_filetype"
 #define CACHED_LANG_ID_KEY "lsp_server_cached_lang_id"
 
+#define MAX_RESTARTS 10
+#define RESTART_DELAY 250  // ms, doubled with every further restart
+#define MAX_RESTART_DELAY 30000
+#define STABLE_RUN_TIME 60  // s, crash counter is reset after running this long
+#define REPLACE_TIMEOUT 5000  // ms, longer than the kill_cb() timeout of stop_process()
+#define CHECK_INTERVAL 30  // s, idle and memory checks
+#define STOP_ALL_TIMEOUT 500  // ms, for all servers together
+
 static void start_lsp_server(LspServer *server);
 static LspServer *lsp_server_init(gint ft);
 
@@ -60,6 +79,7 @@ extern LspProjectConfigurationType project_configuration_type;
 
 static GPtrArray *lsp_servers = NULL;
 static GPtrArray *servers_in_shutdown = NULL;
+static guint check_source_id = 0;
 
 static LspServerInitializedCallback lsp_server_initialized_cb;
 
@@ -67,6 +87,7 @@ static LspServerInitializedCallback lsp_server_initialized_cb;
 static void free_config(LspServerConfig *cfg)
 {
 	g_free(cfg->cmd);
+	g_free(cfg->socket);
 	g_strfreev(cfg->env);
 	g_free(cfg->ref_lang);
 	g_strfreev(cfg->autocomplete_trigger_sequences);
@@ -97,6 +118,15 @@ static void free_config(LspServerConfig *cfg)
 
 static void free_server(LspServer *s)
 {
+	if (s->restart_source_id)
+		g_source_remove(s->restart_source_id);
+	if (s->connect_cancellable)
+	{
+		g_cancellable_cancel(s->connect_cancellable);
+		g_object_unref(s->connect_cancellable);
+	}
+	if (s->reopen_docs)
+		g_ptr_array_free(s->reopen_docs, TRUE);
 	if (s->rpc)
 		lsp_rpc_destroy(s->rpc);
 	if (s->stream)
@@ -108,7 +138,8 @@ static void free_server(LspServer *s)
 
 	g_free(s->autocomplete_trigger_chars);
 	g_free(s->signature_trigger_chars);
-	g_free(s->initialize_response);
+	if (s->initialize_response)
+		g_variant_unref(s->initialize_response);
 	lsp_progress_free_all(s);
 
 	free_config(&s->config);
@@ -127,7 +158,140 @@ static gboolean free_server_after_delay(gpointer user_data)
 
 static gboolean is_dead(LspServer *server)
 {
-	return server->restarts >= 10;
+	return server->restarts >= MAX_RESTARTS;
+}
+
+
+static gboolean start_after_delay(gpointer user_data)
+{
+	LspServer *s = user_data;
+
+	s->restart_source_id = 0;
+	s->startup_shutdown = FALSE;
+	start_lsp_server(s);
+
+	return G_SOURCE_REMOVE;
+}
+
+
+/* file names of the documents open on the server, least recently used first
+ * so reopening them in order restores the order of mru_docs */
+static GPtrArray *get_reopen_docs(LspServer *s)
+{
+	GPtrArray *fnames = g_ptr_array_new_full(0, g_free);
+	GList *node;
+
+	for (node = s->mru_docs.head; node; node = node->next)
+	{
+		GeanyDocument *doc = node->data;
+
+		if (doc->is_valid && doc->file_name)
+			g_ptr_array_add(fnames, g_strdup(doc->file_name));
+	}
+
+	return fnames;
+}
+
+
+/* other filetypes may use @s through ref_lang */
+static void clear_references(LspServer *s)
+{
+	guint i;
+
+	for (i = 0; i < lsp_servers->len; i++)
+	{
+		LspServer *s2 = lsp_servers->pdata[i];
+
+		if (s2->referenced == s)
+			s2->referenced = NULL;
+	}
+}
+
+
+/* replaces @old by a new unstarted server which opens the documents of @old
+ * after initialize, see on_server_initialized() */
+static LspServer *replace_server(LspServer *old)
+{
+	GHashTable *diag_table;
+	LspServer *s;
+
+	clear_references(old);
+	s = lsp_server_init(old->filetype);
+	lsp_servers->pdata[old->filetype] = s;
+
+	s->reopen_docs = get_reopen_docs(old);
+	// now, before the delayed free_server() could clear data of reopened documents
+	lsp_sync_free(old);
+	lsp_sync_init(old);
+
+	// keep showing the last diagnostics until the new server sends them
+	diag_table = s->diag_table;
+	s->diag_table = old->diag_table;
+	old->diag_table = diag_table;
+
+	return s;
+}
+
+
+static void restart_server(LspServer *s)
+{
+	gint restarts = s->restarts;
+
+	// occasional crashes during a long session shouldn't add up
+	if (s->start_time > 0 &&
+		g_get_monotonic_time() - s->start_time > (gint64)STABLE_RUN_TIME * G_USEC_PER_SEC)
+		restarts = 0;
+
+	// it seems that calls/notifications get delivered to the plugin
+	// from the server even after the process is stopped in unnormal
+	// conditions like server crash and if we free the server immediately,
+	// the RPC call gets invalid server. Wait for a while until such
+	// calls get performed
+	plugin_timeout_add(geany_plugin, 300, free_server_after_delay, s);
+
+	if (lsp_servers)  // NULL on plugin unload
+	{
+		guint delay;
+
+		s = replace_server(s);
+		s->restarts = restarts + 1;
+		if (is_dead(s))
+		{
+			msgwin_status_add(_("LSP server %s terminated %d times, giving up"), s->config.cmd, s->restarts);
+			return;
+		}
+
+		delay = s->restarts > 1 ? MIN(RESTART_DELAY << (s->restarts - 2), MAX_RESTART_DELAY) : 0;
+		if (delay == 0)
+			start_lsp_server(s);
+		else
+		{
+			// prevents starting the server in server_get_or_start_for_ft()
+			s->startup_shutdown = TRUE;
+			s->restart_source_id = plugin_timeout_add(geany_plugin, delay, start_after_delay, s);
+		}
+	}
+}
+
+
+/* starts the server replacing a stopped one, see check_servers() */
+static gboolean start_replacement(gpointer user_data)
+{
+	gint ft = GPOINTER_TO_INT(user_data);
+	LspServer *s;
+
+	if (!lsp_servers)
+		return G_SOURCE_REMOVE;
+
+	s = lsp_servers->pdata[ft];
+	if (s->replaces_running)
+	{
+		s->replaces_running = FALSE;
+		s->startup_shutdown = FALSE;
+		start_lsp_server(s);
+	}
+
+	return G_SOURCE_REMOVE;
 }
 
 
@@ -143,32 +307,24 @@ static void process_stopped(GPid pid, gint status, gpointer data)
 	{
 		msgwin_status_add(_("LSP server %s stopped"), s->config.cmd);
 		g_ptr_array_remove_fast(servers_in_shutdown, s);
+		start_replacement(GINT_TO_POINTER(s->filetype));
 	}
 	else  // crash
 	{
-		gint restarts = s->restarts;
-		gint ft = s->filetype;
-
 		msgwin_status_add(_("LSP server %s stopped unexpectedly, restarting"), s->config.cmd);
+		restart_server(s);
+	}
+}
 
-		// it seems that calls/notifications get delivered to the plugin
-		// from the server even after the process is stopped in unnormal
-		// conditions like server crash and if we free the server immediately,
-		// the RPC call gets invalid server. Wait for a while until such
-		// calls get performed
-		plugin_timeout_add(geany_plugin, 300, free_server_after_delay, s);
 
-		if (lsp_servers)  // NULL on plugin unload
-		{
-			s = lsp_server_init(ft);
-			s->restarts = restarts + 1;
-			lsp_servers->pdata[ft] = s;
-			if (is_dead(s))
-				msgwin_status_add(_("LSP server %s terminated %d times, giving up"), s->config.cmd, s->restarts);
-			else
-				start_lsp_server(s);
-		}
-	}
+/* the other side closed the connection to a server attached over a socket */
+void lsp_server_connection_failed(LspServer *s)
+{
+	if (!s->attached || !lsp_servers || lsp_servers->pdata[s->filetype] != s)
+		return;
+
+	msgwin_status_add(_("Connection to LSP server %s lost, reconnecting"), s->config.cmd);
+	restart_server(s);
 }
 
 
@@ -230,9 +386,6 @@ static void stop_process(LspServer *s)
 	s->startup_shutdown = TRUE;
 	g_ptr_array_add(servers_in_shutdown, s);
 
-	if (lsp_servers)  // NULL on plugin unload
-		lsp_servers->pdata[s->filetype] = lsp_server_init(s->filetype);
-
 	msgwin_status_add(_("Sending shutdown request to LSP server %s"), s->config.cmd);
 	lsp_rpc_call_startup_shutdown(s, "shutdown", NULL, shutdown_cb, s);
 
@@ -246,7 +399,12 @@ static void stop_and_free_server(LspServer *s)
 	if (s->pid)
 		stop_process(s);
 	else
+	{
+		// the server keeps running with its index for the next connection
+		if (s->attached)
+			msgwin_status_add(_("Detaching from LSP server %s"), s->config.cmd);
 		free_server(s);
+	}
 }
 
 
@@ -516,41 +674,62 @@ static void send_did_change_configuration(LspServer *srv)
 }
 
 
+/* disables features the server doesn't support, performed again when
+ * the configuration is reloaded */
+static void apply_capabilities(LspServer *s, GVariant *return_value)
+{
+	gboolean supports_semantic_token_range, supports_semantic_token_full;
+
+	if (EMPTY(s->signature_trigger_chars))
+		s->config.signature_enable = FALSE;
+
+	update_config(return_value, &s->config.autocomplete_enable, "completionProvider");
+	update_config(return_value, &s->config.hover_enable, "hoverProvider");
+	update_config(return_value, &s->config.hover_available, "hoverProvider");
+	update_config(return_value, &s->config.goto_enable, "definitionProvider");
+	update_config(return_value, &s->config.document_symbols_enable, "documentSymbolProvider");
+	update_config(return_value, &s->config.document_symbols_available, "documentSymbolProvider");
+	update_config(return_value, &s->config.highlighting_enable, "documentHighlightProvider");
+	update_config(return_value, &s->config.code_lens_enable, "codeLensProvider");
+	update_config(return_value, &s->config.goto_declaration_enable, "declarationProvider");
+	update_config(return_value, &s->config.goto_definition_enable, "definitionProvider");
+	update_config(return_value, &s->config.goto_implementation_enable, "implementationProvider");
+	update_config(return_value, &s->config.goto_references_enable, "referencesProvider");
+	update_config(return_value, &s->config.goto_type_definition_enable, "typeDefinitionProvider");
+	update_config(return_value, &s->config.document_formatting_enable, "documentFormattingProvider");
+	update_config(return_value, &s->config.range_formatting_enable, "documentRangeFormattingProvider");
+	update_config(return_value, &s->config.execute_command_enable, "executeCommandProvider");
+	update_config(return_value, &s->config.code_action_enable, "codeActionProvider");
+	update_config(return_value, &s->config.rename_enable, "renameProvider");
+	update_config(return_value, &s->config.selection_range_enable, "selectionRangeProvider");
+
+	supports_semantic_token_range = has_capability(return_value, "semanticTokensProvider", "range", NULL);
+	supports_semantic_token_full = has_capability(return_value, "semanticTokensProvider", "full", NULL);
+	s->config.semantic_tokens_supports_delta = has_capability(return_value,
+		"semanticTokensProvider", "full", "delta");
+
+	s->config.semantic_tokens_enable = s->config.semantic_tokens_enable &&
+		(supports_semantic_token_full || supports_semantic_token_range);
+	s->config.semantic_tokens_range_only = !supports_semantic_token_full &&
+		supports_semantic_token_range;
+
+	s->semantic_token_mask = get_semantic_token_mask(s, return_value);
+}
+
+
 static void initialize_cb(GVariant *return_value, GError *error, gpointer user_data)
 {
 	LspServer *s = user_data;
 
 	if (!error)
 	{
-		gboolean supports_semantic_token_range, supports_semantic_token_full;
-
 		g_free(s->autocomplete_trigger_chars);
 		s->autocomplete_trigger_chars = get_autocomplete_trigger_chars(return_value);
 
 		g_free(s->signature_trigger_chars);
 		s->signature_trigger_chars = get_signature_trigger_chars(return_value);
-		if (EMPTY(s->signature_trigger_chars))
-			s->config.signature_enable = FALSE;
-
-		update_config(return_value, &s->config.autocomplete_enable, "completionProvider");
-		update_config(return_value, &s->config.hover_enable, "hoverProvider");
-		update_config(return_value, &s->config.hover_available, "hoverProvider");
-		update_config(return_value, &s->config.goto_enable, "definitionProvider");
-		update_config(return_value, &s->config.document_symbols_enable, "documentSymbolProvider");
-		update_config(return_value, &s->config.document_symbols_available, "documentSymbolProvider");
-		update_config(return_value, &s->config.highlighting_enable, "documentHighlightProvider");
-		update_config(return_value, &s->config.code_lens_enable, "codeLensProvider");
-		update_config(return_value, &s->config.goto_declaration_enable, "declarationProvider");
-		update_config(return_value, &s->config.goto_definition_enable, "definitionProvider");
-		update_config(return_value, &s->config.goto_implementation_enable, "implementationProvider");
-		update_config(return_value, &s->config.goto_references_enable, "referencesProvider");
-		update_config(return_value, &s->config.goto_type_definition_enable, "typeDefinitionProvider");
-		update_config(return_value, &s->config.document_formatting_enable, "documentFormattingProvider");
-		update_config(return_value, &s->config.range_formatting_enable, "documentRangeFormattingProvider");
-		update_config(return_value, &s->config.execute_command_enable, "executeCommandProvider");
-		update_config(return_value, &s->config.code_action_enable, "codeActionProvider");
-		update_config(return_value, &s->config.rename_enable, "renameProvider");
-		update_config(return_value, &s->config.selection_range_enable, "selectionRangeProvider");
+
+		apply_capabilities(s, return_value);
 
 		s->supports_completion_resolve = has_capability(return_value, "completionProvider", "resolveProvider", NULL);
 
@@ -562,19 +741,8 @@ static void initialize_cb(GVariant *return_value, GError *error, gpointer user_d
 		s->include_text_on_save = has_capability(return_value, "textDocumentSync", "save", "includeText");
 		s->use_workspace_folders = use_workspace_folders(return_value);
 
-		s->initialize_response = lsp_utils_json_pretty_print(return_value);
-
-		supports_semantic_token_range = has_capability(return_value, "semanticTokensProvider", "range", NULL);
-		supports_semantic_token_full = has_capability(return_value, "semanticTokensProvider", "full", NULL);
-		s->config.semantic_tokens_supports_delta = has_capability(return_value,
-			"semanticTokensProvider", "full", "delta");
-
-		s->config.semantic_tokens_enable = s->config.semantic_tokens_enable &&
-			(supports_semantic_token_full || supports_semantic_token_range);
-		s->config.semantic_tokens_range_only = !supports_semantic_token_full &&
-			supports_semantic_token_range;
-
-		s->semantic_token_mask = get_semantic_token_mask(s, return_value);
+		s->initialize_response = g_variant_ref(return_value);
+		s->start_time = g_get_monotonic_time();
 
 		msgwin_status_add(_("LSP server %s initialized"), s->config.cmd);
 
@@ -744,6 +912,15 @@ static void perform_initialize(LspServer *server)
 		"}",
 		"workspace", "{",
 			"applyEdit", JSONRPC_MESSAGE_PUT_BOOLEAN(TRUE),
+			"workspaceEdit", "{",
+				"documentChanges", JSONRPC_MESSAGE_PUT_BOOLEAN(TRUE),
+				"resourceOperations", "[",
+					"create",
+					"rename",
+					"delete",
+				"]",
+				"failureHandling", JSONRPC_MESSAGE_PUT_STRING("abort"),
+			"}",
 			"symbol", "{",
 				"symbolKind", "{",
 					"valueSet", "[",
@@ -829,6 +1006,90 @@ static void stderr_cb(GString *string, GIOCondition condition, gpointer data)
 }
 
 
+#ifdef G_OS_UNIX
+static void connect_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	LspServer *server = user_data;
+	GSocketConnection *connection;
+	GError *error = NULL;
+
+	connection = g_socket_client_connect_finish(G_SOCKET_CLIENT(source), res, &error);
+
+	// the server has been freed in the meantime
+	if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+	{
+		g_error_free(error);
+		return;
+	}
+
+	g_clear_object(&server->connect_cancellable);
+	server->startup_shutdown = FALSE;
+
+	if (connection)
+	{
+		server->attached = TRUE;
+		server->stream = G_IO_STREAM(connection);
+
+		server->log = lsp_log_start(&server->config);
+		server->rpc = lsp_rpc_new(server, server->stream);
+
+		perform_initialize(server);
+	}
+	else
+	{
+		// the server behind the socket may be just restarting
+		msgwin_status_add(_("Failed to connect to LSP server %s: %s"), server->config.cmd, error->message);
+		g_error_free(error);
+		restart_server(server);
+	}
+}
+#endif
+
+
+static void connect_lsp_server(LspServer *server)
+{
+#ifdef G_OS_UNIX
+	GSocketClient *client;
+	GSocketAddress *address;
+	gchar *path;
+
+	if (g_str_has_prefix(server->config.socket, "~/"))
+		path = g_build_filename(g_get_home_dir(), server->config.socket + 2, NULL);
+	else
+		path = g_strdup(server->config.socket);
+
+	msgwin_status_add(_("Connecting to LSP server %s"), path);
+
+	// prevents starting the server in server_get_or_start_for_ft() again
+	server->startup_shutdown = TRUE;
+	server->connect_cancellable = g_cancellable_new();
+
+	client = g_socket_client_new();
+	address = g_unix_socket_address_new(path);
+	g_socket_client_connect_async(client, G_SOCKET_CONNECTABLE(address),
+		server->connect_cancellable, connect_cb, server);
+
+	g_object_unref(address);
+	g_object_unref(client);
+	g_free(path);
+#else
+	msgwin_status_add(_("Connecting to LSP servers over sockets is not supported on this platform"));
+	server->restarts = 100;
+#endif
+}
+
+
+/* larger pipes need fewer context switches for big messages like didOpen
+ * of a large file; the kernel limits the size by /proc/sys/fs/pipe-max-size */
+static void set_pipe_size(gint fd, gint size_kb)
+{
+#ifdef __linux__
+	if (size_kb > 0)
+		fcntl(fd, F_SETPIPE_SZ, size_kb * 1024);  // the default size is kept on failure
+#endif
+}
+
+
 static void start_lsp_server(LspServer *server)
 {
 	GInputStream *input_stream;
@@ -837,7 +1098,15 @@ static void start_lsp_server(LspServer *server)
 	gint stdin_fd = -1;
 	gint stdout_fd = -1;
 	gboolean success;
-	GString *cmd = g_string_new(server->config.cmd);
+	GString *cmd;
+
+	if (!EMPTY(server->config.socket))
+	{
+		connect_lsp_server(server);
+		return;
+	}
+
+	cmd = g_string_new(server->config.cmd);
 
 #ifdef G_OS_UNIX
 	// command itself
@@ -865,6 +1134,9 @@ static void start_lsp_server(LspServer *server)
 		return;
 	}
 
+	set_pipe_size(stdin_fd, server->config.pipe_buffer_size_kb);
+	set_pipe_size(stdout_fd, server->config.pipe_buffer_size_kb);
+
 #ifdef G_OS_UNIX
 	input_stream = g_unix_input_stream_new(stdout_fd, TRUE);
 	output_stream = g_unix_output_stream_new(stdin_fd, TRUE);
@@ -997,6 +1269,11 @@ static void load_config(GKeyFile *kf, const gchar *section, LspServer *s)
 
 	get_bool(&s->config.progress_bar_enable, kf, section, "progress_bar_enable");
 	get_bool(&s->config.swap_header_source_enable, kf, section, "swap_header_source_enable");
+	get_int(&s->config.idle_shutdown_minutes, kf, section, "idle_shutdown_minutes");
+	get_int(&s->config.max_rss_mb, kf, section, "max_rss_mb");
+	get_int(&s->config.pipe_buffer_size_kb, kf, section, "pipe_buffer_size_kb");
+	get_int(&s->config.max_open_documents, kf, section, "max_open_documents");
+	get_int(&s->config.reduce_open_documents_rss_mb, kf, section, "reduce_open_documents_rss_mb");
 
 	get_str(&s->config.trace_value, kf, section, "trace_value");
 	get_bool(&s->config.enable_telemetry, kf, section, "telemetry_notifications");
@@ -1038,11 +1315,14 @@ static void load_config(GKeyFile *kf, const gchar *section, LspServer *s)
 static void load_all_section_only_config(GKeyFile *kf, const gchar *section, LspServer *s)
 {
 	get_bool(&s->config.enable_by_default, kf, section, "enable_by_default");
+	get_bool(&s->config.prewarm_on_project_open, kf, section, "prewarm_on_project_open");
+	get_bool(&s->config.detach_on_quit, kf, section, "detach_on_quit");
 
 	get_int(&s->config.command_keybinding_num, kf, section, "command_keybinding_num");
 	s->config.command_keybinding_num = CLAMP(s->config.command_keybinding_num, 1, 1000);
 
 	get_str(&s->config.document_symbols_tab_label, kf, section, "document_symbols_tab_label");
+	get_bool(&s->config.symbol_index_enable, kf, section, "symbol_index_enable");
 }
 
 
@@ -1061,6 +1341,7 @@ static void load_filetype_only_config(GKeyFile *kf, const gchar *section, LspSer
 		SETPTR(s->config.ref_lang, use);
 	}
 
+	get_str(&s->config.socket, kf, section, "socket");
 	get_strv(&s->config.env, kf, section, "env");
 	get_str(&s->config.rpc_log, kf, section, "rpc_log");
 	get_str(&s->config.initialization_options_file, kf, section, "initialization_options_file");
@@ -1083,7 +1364,7 @@ static LspServer *server_get_or_start_for_ft(GeanyFiletype *ft, gboolean launch_
 	if (s->startup_shutdown)
 		return NULL;
 
-	if (s->pid)
+	if (s->pid || s->attached)
 		return s;
 
 	if (s->not_used)
@@ -1103,7 +1384,7 @@ static LspServer *server_get_or_start_for_ft(GeanyFiletype *ft, gboolean launch_
 		{
 			s2 = g_ptr_array_index(lsp_servers, ref_ft->id);
 			s->referenced = s2;
-			if (s2->pid)
+			if (s2->pid || s2->attached)
 				return s2;
 		}
 	}
@@ -1111,18 +1392,10 @@ static LspServer *server_get_or_start_for_ft(GeanyFiletype *ft, gboolean launch_
 	if (s2)
 		s = s2;
 
-	if (s->config.cmd)
-		g_strstrip(s->config.cmd);
 	if (EMPTY(s->config.cmd))
-	{
-		g_free(s->config.cmd);
-		s->config.cmd = NULL;
 		s->not_used = TRUE;
-	}
 	else
-	{
 		start_lsp_server(s);
-	}
 
 	// the server isn't initialized when running for the first time because the async
 	// handshake with the server hasn't completed yet
@@ -1136,20 +1409,20 @@ LspServer *lsp_server_get_for_ft(GeanyFiletype *ft)
 }
 
 
-static gboolean is_lsp_valid_for_doc(LspServerConfig *cfg, GeanyDocument *doc)
+static gboolean is_lsp_valid_for_file(LspServerConfig *cfg, const gchar *locale_real_path)
 {
 	gchar *base_path, *real_path, *rel_path;
 	gboolean inside_project;
 
-	if (!doc || !doc->real_path)
+	if (!locale_real_path)
 		return FALSE;
 
-	if (EMPTY(cfg->cmd))
+	if (EMPTY(cfg->cmd) && EMPTY(cfg->socket))
 		return FALSE;
 
 	if (cfg->project_root_marker_patterns)
 	{
-		gchar *project_root = lsp_utils_find_project_root(doc, cfg);
+		gchar *project_root = lsp_utils_find_project_root_for_file(locale_real_path, cfg);
 		if (project_root)
 		{
 			g_free(project_root);
@@ -1165,7 +1438,7 @@ static gboolean is_lsp_valid_for_doc(LspServerConfig *cfg, GeanyDocument *doc)
 		return TRUE;
 
 	base_path = lsp_utils_get_project_base_path();
-	real_path = utils_get_utf8_from_locale(doc->real_path);
+	real_path = utils_get_utf8_from_locale(locale_real_path);
 	rel_path = lsp_utils_get_relative_path(base_path, real_path);
 
 	inside_project = rel_path && !g_str_has_prefix(rel_path, "..");
@@ -1178,57 +1451,214 @@ static gboolean is_lsp_valid_for_doc(LspServerConfig *cfg, GeanyDocument *doc)
 }
 
 
+static gboolean is_lsp_valid_for_doc(LspServerConfig *cfg, GeanyDocument *doc)
+{
+	return doc && is_lsp_valid_for_file(cfg, doc->real_path);
+}
+
+
 #if ! GLIB_CHECK_VERSION(2, 70, 0)
 #define g_pattern_spec_match_string g_pattern_match_string
 #endif
 
-static GeanyFiletype *lsp_server_get_ft_impl(GeanyDocument *doc, gchar **lsp_lang_id)
+typedef struct
+{
+	guint order;  // position in the configuration, the first matching wins
+	GeanyFiletype *ft;
+	gchar *lang_id;
+	GPatternSpec *spec;  // only for glob patterns
+} LangIdMapping;
+
+
+/* lang_id_mappings of all servers compiled when first needed */
+static struct
+{
+	GPtrArray *mappings;  // LangIdMapping*, owns them
+	GHashTable *exact;    // basename -> LangIdMapping*
+	GHashTable *suffix;   // suffix of "*suffix" patterns -> LangIdMapping*
+	GPtrArray *globs;     // LangIdMapping* of other patterns in order
+} lang_id_matcher = {NULL, NULL, NULL, NULL};
+
+
+static void free_lang_id_mapping(LangIdMapping *m)
+{
+	if (m->spec)
+		g_pattern_spec_free(m->spec);
+	g_free(m->lang_id);
+	g_free(m);
+}
+
+
+static void lang_id_matcher_clear(void)
+{
+	if (!lang_id_matcher.mappings)
+		return;
+
+	g_hash_table_destroy(lang_id_matcher.exact);
+	g_hash_table_destroy(lang_id_matcher.suffix);
+	g_ptr_array_free(lang_id_matcher.globs, TRUE);
+	g_ptr_array_free(lang_id_matcher.mappings, TRUE);
+	lang_id_matcher.mappings = NULL;
+}
+
+
+static gboolean has_wildcards(const gchar *str)
+{
+	return strchr(str, '*') || strchr(str, '?');
+}
+
+
+static void lang_id_matcher_build(void)
 {
 	LspServer *srv;
 	guint i;
 
-	if (!lsp_servers || !doc->real_path)
-	{
-		*lsp_lang_id = lsp_utils_get_lsp_lang_id(doc);
-		return doc->file_type;
-	}
+	lang_id_matcher.mappings = g_ptr_array_new_with_free_func((GDestroyNotify)free_lang_id_mapping);
+	lang_id_matcher.exact = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	lang_id_matcher.suffix = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	lang_id_matcher.globs = g_ptr_array_new();
 
 	foreach_ptr_array(srv, i, lsp_servers)
 	{
-		gint j = 0;
-		gchar **val;
-		gchar *lang_id = NULL;
+		gchar **mappings = srv->config.lang_id_mappings;
+		guint j;
 
-		if (!srv->config.lang_id_mappings || EMPTY(srv->config.cmd))
+		if (!mappings || (EMPTY(srv->config.cmd) && EMPTY(srv->config.socket)))
 			continue;
 
-		foreach_strv(val, srv->config.lang_id_mappings)
+		// pairs of lang_id and pattern
+		for (j = 0; mappings[j] && mappings[j + 1]; j += 2)
 		{
-			if (j % 2 == 0)
-				lang_id = *val;
-			else
-			{
-				GPatternSpec *spec = g_pattern_spec_new(*val);
-				gchar *fname = g_path_get_basename(doc->file_name);
-				GeanyFiletype *ret = NULL;
+			const gchar *pattern = mappings[j + 1];
+			LangIdMapping *m = g_new0(LangIdMapping, 1);
+			GHashTable *table = NULL;
+			const gchar *key = NULL;
 
-				if (g_pattern_spec_match_string(spec, fname))
-					ret = filetypes_index(i);
+			m->order = lang_id_matcher.mappings->len;
+			m->ft = filetypes_index(i);
+			m->lang_id = g_strdup(mappings[j]);
+			g_ptr_array_add(lang_id_matcher.mappings, m);
 
-				g_pattern_spec_free(spec);
-				g_free(fname);
+			if (!has_wildcards(pattern))
+			{
+				table = lang_id_matcher.exact;
+				key = pattern;
+			}
+			else if (pattern[0] == '*' && !has_wildcards(pattern + 1))
+			{
+				table = lang_id_matcher.suffix;
+				key = pattern + 1;
+			}
 
-				if (ret)
-				{
-					*lsp_lang_id = g_strdup(lang_id);
-					return ret;
-				}
+			if (!table)
+			{
+				m->spec = g_pattern_spec_new(pattern);
+				g_ptr_array_add(lang_id_matcher.globs, m);
 			}
+			else if (!g_hash_table_contains(table, key))  // keep the first one
+				g_hash_table_insert(table, g_strdup(key), m);
+		}
+	}
+}
+
+
+static LangIdMapping *lang_id_matcher_lookup(const gchar *fname)
+{
+	LangIdMapping *best, *m;
+	gsize len = strlen(fname);
+	gsize pos;
+	guint i;
+
+	if (!lang_id_matcher.mappings)
+		lang_id_matcher_build();
+
+	best = g_hash_table_lookup(lang_id_matcher.exact, fname);
+
+	// every suffix of the name, including the empty one matched by "*"
+	for (pos = 0; pos <= len; pos++)
+	{
+		m = g_hash_table_lookup(lang_id_matcher.suffix, fname + pos);
+		if (m && (!best || m->order < best->order))
+			best = m;
+	}
 
-			j++;
+	// globs are in order, only earlier ones can win
+	foreach_ptr_array(m, i, lang_id_matcher.globs)
+	{
+		if (best && m->order > best->order)
+			break;
+		if (g_pattern_spec_match_string(m->spec, fname))
+		{
+			best = m;
+			break;
 		}
 	}
 
+	return best;
+}
+
+
+/* Returns the filetype whose server would be used for the file once it's
+ * opened in Geany as @ft, or NULL if no server would be used for it. */
+GeanyFiletype *lsp_server_get_ft_for_file(const gchar *locale_fname, GeanyFiletype *ft)
+{
+	gchar *utf8_fname, *fname, *real_path;
+	LangIdMapping *m;
+	LspServer *s;
+	gboolean valid;
+
+	if (!lsp_servers || lsp_utils_is_lsp_disabled_for_project())
+		return NULL;
+
+	utf8_fname = utils_get_utf8_from_locale(locale_fname);
+	fname = g_path_get_basename(utf8_fname);
+	m = lang_id_matcher_lookup(fname);
+	if (m)
+		ft = m->ft;
+	else if (!ft)
+		ft = filetypes_detect_from_file(utf8_fname);
+	g_free(fname);
+	g_free(utf8_fname);
+
+	if (!ft)
+		return NULL;
+
+	s = lsp_servers->pdata[ft->id];
+	if (s->config.ref_lang)
+	{
+		GeanyFiletype *ref_ft = filetypes_lookup_by_name(s->config.ref_lang);
+
+		if (!ref_ft)
+			return NULL;
+		s = lsp_servers->pdata[ref_ft->id];
+	}
+
+	real_path = utils_get_real_path(locale_fname);
+	valid = is_lsp_valid_for_file(&s->config, real_path);
+	g_free(real_path);
+
+	return valid ? ft : NULL;
+}
+
+
+static GeanyFiletype *lsp_server_get_ft_impl(GeanyDocument *doc, gchar **lsp_lang_id)
+{
+	LangIdMapping *m = NULL;
+
+	if (lsp_servers && doc->real_path)
+	{
+		gchar *fname = g_path_get_basename(doc->file_name);
+
+		m = lang_id_matcher_lookup(fname);
+		g_free(fname);
+	}
+
+	if (m)
+	{
+		*lsp_lang_id = g_strdup(m->lang_id);
+		return m->ft;
+	}
+
 	*lsp_lang_id = lsp_utils_get_lsp_lang_id(doc);
 	return doc->file_type;
 }
@@ -1330,6 +1760,25 @@ LspServerConfig *lsp_server_get_all_section_config(void)
 }
 
 
+/* whether @srv hasn't been freed yet, e.g. before using a server stored
+ * for a request callback */
+gboolean lsp_server_is_alive(LspServer *srv)
+{
+	guint i;
+
+	if (lsp_servers)
+	{
+		for (i = 0; i < lsp_servers->len; i++)
+		{
+			if (lsp_servers->pdata[i] == srv)
+				return TRUE;
+		}
+	}
+
+	return servers_in_shutdown && g_ptr_array_find(servers_in_shutdown, srv, NULL);
+}
+
+
 gboolean lsp_server_is_usable(GeanyDocument *doc)
 {
 	LspServer *s = server_get_configured_for_doc(doc);
@@ -1341,7 +1790,53 @@ gboolean lsp_server_is_usable(GeanyDocument *doc)
 }
 
 
-void lsp_server_stop_all(gboolean wait)
+static gboolean stop_all_timeout_cb(gpointer user_data)
+{
+	gboolean *timed_out = user_data;
+
+	*timed_out = TRUE;
+	return G_SOURCE_REMOVE;
+}
+
+
+/* waits without a timeout when @timeout is 0 */
+static void wait_for_servers_in_shutdown(guint timeout)
+{
+	GMainContext *main_context = g_main_context_ref_thread_default();
+	gboolean timed_out = FALSE;
+	guint source_id = 0;
+
+	if (timeout > 0)
+		source_id = g_timeout_add(timeout, stop_all_timeout_cb, &timed_out);
+
+	// this runs the main loop and blocks - otherwise gio won't return async results
+	while (servers_in_shutdown->len > 0 && !timed_out)
+		g_main_context_iteration(main_context, TRUE);
+
+	if (source_id && !timed_out)
+		g_source_remove(source_id);
+
+	g_main_context_unref(main_context);
+}
+
+
+static void force_kill_server(LspServer *s)
+{
+	if (s->pid > 0)
+	{
+#ifdef G_OS_UNIX
+		kill(s->pid, SIGKILL);
+#else
+		kill_server(s);  // TerminateProcess(), already forced
+#endif
+	}
+}
+
+
+/* Servers are asked to shut down all at once. When waiting, servers which
+ * don't exit within STOP_ALL_TIMEOUT are killed or, when quitting Geany with
+ * detach_on_quit set, left running to exit on their own. */
+void lsp_server_stop_all(gboolean wait, gboolean quitting)
 {
 	GPtrArray *lsp_servers_tmp = lsp_servers;
 
@@ -1351,15 +1846,31 @@ void lsp_server_stop_all(gboolean wait)
 	if (lsp_servers_tmp)
 		g_ptr_array_free(lsp_servers_tmp, TRUE);
 
+	lang_id_matcher_clear();
+
 	if (wait)
 	{
-		GMainContext *main_context = g_main_context_ref_thread_default();
+		LspServer *s;
+		guint i;
 
-		// this runs the main loop and blocks - otherwise gio won't return async results
-		while (servers_in_shutdown->len > 0)
-			g_main_context_iteration(main_context, TRUE);
+		wait_for_servers_in_shutdown(STOP_ALL_TIMEOUT);
+
+		foreach_ptr_array(s, i, servers_in_shutdown)
+		{
+			// the process is reaped by the system after Geany exits
+			if (quitting && s->config.detach_on_quit)
+				msgwin_status_add(_("Leaving LSP server %s running"), s->config.cmd);
+			else
+			{
+				msgwin_status_add(_("Force terminating LSP server %s"), s->config.cmd);
+				force_kill_server(s);
+			}
+		}
 
-		g_main_context_unref(main_context);
+		// on plugin unload, process_stopped() of killed servers must be
+		// called before the plugin code is gone - SIGKILL always ends them
+		if (!quitting)
+			wait_for_servers_in_shutdown(0);
 	}
 }
 
@@ -1394,6 +1905,18 @@ static LspServer *lsp_server_new(GKeyFile *kf_global, GKeyFile *kf, GeanyFiletyp
 	g_free(s->config.word_chars);
 	s->config.word_chars = g_string_free(wc, FALSE);
 
+	// done here so configs of running and reloaded servers can be compared
+	if (s->config.cmd)
+		g_strstrip(s->config.cmd);
+	// the socket identifies the server in messages
+	if (EMPTY(s->config.cmd) && !EMPTY(s->config.socket))
+		SETPTR(s->config.cmd, g_strdup(s->config.socket));
+	if (EMPTY(s->config.cmd))
+	{
+		g_free(s->config.cmd);
+		s->config.cmd = NULL;
+	}
+
 	lsp_sync_init(s);
 	lsp_diagnostics_init(s);
 	lsp_workspace_folders_init(s);
@@ -1416,6 +1939,92 @@ static LspServer *lsp_server_init(gint ft)
 }
 
 
+static gboolean is_server_used(LspServer *s)
+{
+	guint i;
+
+	foreach_document(i)
+	{
+		if (lsp_server_get_if_running(documents[i]) == s)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+/* Stops servers without open documents for idle_shutdown_minutes, they are
+ * started again when a document using them is opened. Servers exceeding
+ * max_rss_mb are restarted and get the open documents again. */
+static gboolean check_servers(gpointer user_data)
+{
+	gint64 now = g_get_monotonic_time();
+	guint i;
+
+	if (!lsp_servers)
+		return G_SOURCE_CONTINUE;
+
+	for (i = 0; i < lsp_servers->len; i++)
+	{
+		LspServer *s = lsp_servers->pdata[i];
+		LspProcStat stat;
+		guint rss_mb = 0;
+
+		// attached servers may be used by other clients, no need to stop them
+		if (!s->pid || s->startup_shutdown)
+			continue;
+
+		if (s->config.idle_shutdown_minutes <= 0 || is_server_used(s))
+			s->idle_since = 0;
+		else if (s->idle_since == 0)
+			s->idle_since = now;
+		else if (now - s->idle_since >= (gint64)s->config.idle_shutdown_minutes * 60 * G_USEC_PER_SEC)
+		{
+			msgwin_status_add(_("LSP server %s not used for %d minutes, shutting down"),
+				s->config.cmd, s->config.idle_shutdown_minutes);
+			clear_references(s);
+			lsp_servers->pdata[i] = lsp_server_init(i);
+			stop_and_free_server(s);
+			continue;
+		}
+
+		if ((s->config.max_rss_mb > 0 || s->config.reduce_open_documents_rss_mb > 0) &&
+			lsp_procstat_read(s->pid, &stat))
+			rss_mb = stat.rss_kb / 1024;
+
+		if (s->config.max_open_documents > 0 && s->config.reduce_open_documents_rss_mb > 0)
+		{
+			guint threshold = s->config.reduce_open_documents_rss_mb;
+
+			// halve the limit every check until below the threshold, then
+			// slowly raise it back once the server uses clearly less memory
+			if (rss_mb > threshold)
+				lsp_sync_set_open_docs_limit(s, s->open_docs_limit / 2);
+			else if (rss_mb < threshold * 3 / 4 && s->open_docs_limit < (guint)s->config.max_open_documents)
+				lsp_sync_set_open_docs_limit(s, s->open_docs_limit * 2);
+		}
+
+		if (s->config.max_rss_mb > 0 && rss_mb > (guint)s->config.max_rss_mb)
+		{
+			LspServer *s_new;
+
+			msgwin_status_add(_("LSP server %s uses %u MB of memory, restarting"),
+				s->config.cmd, rss_mb);
+			s_new = replace_server(s);
+			s_new->restarts = s->restarts;
+			// not running both processes at once, the new one starts when
+			// the old one stops or at the latest after it's been killed
+			s_new->startup_shutdown = TRUE;
+			s_new->replaces_running = TRUE;
+			stop_and_free_server(s);
+			plugin_timeout_add(geany_plugin, REPLACE_TIMEOUT, start_replacement, GINT_TO_POINTER(i));
+		}
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+
 void lsp_server_init_all(void)
 {
 	GKeyFile *kf_global = read_keyfile(lsp_utils_get_global_config_filename());
@@ -1424,11 +2033,13 @@ void lsp_server_init_all(void)
 	guint i;
 
 	if (lsp_servers)
-		lsp_server_stop_all(FALSE);
+		lsp_server_stop_all(FALSE, FALSE);
 
 	if (!servers_in_shutdown)
 		servers_in_shutdown = g_ptr_array_new_full(0, (GDestroyNotify)free_server);
 
+	lang_id_matcher_clear();
+
 	foreach_document(i)
 	{
 		GeanyDocument *doc = documents[i];
@@ -1437,6 +2048,12 @@ void lsp_server_init_all(void)
 
 	lsp_servers = g_ptr_array_new_full(0, (GDestroyNotify)stop_and_free_server);
 
+	if (!check_source_id)
+	{
+		check_source_id = plugin_timeout_add(geany_plugin, CHECK_INTERVAL * 1000,
+			check_servers, NULL);
+	}
+
 	for (i = 0; (ft = filetypes_index(i)); i++)
 	{
 		LspServer *s = lsp_server_new(kf_global, kf, ft);
@@ -1448,6 +2065,121 @@ void lsp_server_init_all(void)
 }
 
 
+static gboolean uses_init_file(LspServer *s, const gchar *path)
+{
+	gboolean found = FALSE;
+
+	if (path && s->config.initialization_options_file)
+	{
+		gchar *p1 = utils_get_real_path(path);
+		gchar *p2 = utils_get_real_path(s->config.initialization_options_file);
+
+		found = g_strcmp0(p1, p2) == 0;
+
+		g_free(p1);
+		g_free(p2);
+	}
+
+	return found;
+}
+
+
+static gboolean strv_equal(gchar **strv1, gchar **strv2)
+{
+	if (!strv1 || !strv2)
+		return strv1 == strv2;
+
+	for (; *strv1 && *strv2; strv1++, strv2++)
+	{
+		if (g_strcmp0(*strv1, *strv2) != 0)
+			return FALSE;
+	}
+	return !*strv1 && !*strv2;
+}
+
+
+static gboolean launch_config_equal(LspServerConfig *c1, LspServerConfig *c2)
+{
+	return g_strcmp0(c1->cmd, c2->cmd) == 0 &&
+		g_strcmp0(c1->socket, c2->socket) == 0 &&
+		g_strcmp0(c1->ref_lang, c2->ref_lang) == 0 &&
+		strv_equal(c1->env, c2->env) &&
+		strv_equal(c1->lang_id_mappings, c2->lang_id_mappings) &&
+		strv_equal(c1->project_root_marker_patterns, c2->project_root_marker_patterns) &&
+		g_strcmp0(c1->initialization_options_file, c2->initialization_options_file) == 0 &&
+		g_strcmp0(c1->initialization_options, c2->initialization_options) == 0 &&
+		g_strcmp0(c1->rpc_log, c2->rpc_log) == 0 &&
+		c1->rpc_log_full == c2->rpc_log_full &&
+		g_strcmp0(c1->trace_value, c2->trace_value) == 0 &&
+		c1->autocomplete_use_snippets == c2->autocomplete_use_snippets &&
+		c1->send_did_change_configuration == c2->send_did_change_configuration &&
+		c1->use_outside_project_dir == c2->use_outside_project_dir &&
+		c1->use_without_project == c2->use_without_project &&
+		c1->pipe_buffer_size_kb == c2->pipe_buffer_size_kb;
+}
+
+
+/* Reloads the configuration files. Running servers are only restarted when
+ * an option used for starting them or during the initialize handshake
+ * changed or when they use the modified @init_file, other servers get the
+ * new configuration without restart. */
+void lsp_server_reload_config(const gchar *init_file)
+{
+	GKeyFile *kf_global, *kf;
+	GeanyFiletype *ft;
+	guint i;
+
+	if (!lsp_servers)
+	{
+		lsp_server_init_all();
+		return;
+	}
+
+	kf_global = read_keyfile(lsp_utils_get_global_config_filename());
+	kf = read_keyfile(lsp_utils_get_config_filename());
+
+	// lang_id_mappings may have changed
+	lang_id_matcher_clear();
+	foreach_document(i)
+	{
+		GeanyDocument *doc = documents[i];
+		lsp_server_clear_cached_ft(doc);
+	}
+
+	for (i = 0; i < lsp_servers->len && (ft = filetypes_index(i)); i++)
+	{
+		LspServer *s = lsp_servers->pdata[i];
+		LspServer *s_new = lsp_server_new(kf_global, kf, ft);
+		gboolean running = s->pid || s->attached;
+
+		if (running && launch_config_equal(&s->config, &s_new->config) &&
+			!uses_init_file(s, init_file))
+		{
+			LspServerConfig tmp = s->config;
+
+			s->config = s_new->config;
+			s_new->config = tmp;
+			free_server(s_new);
+
+			lsp_sync_set_open_docs_limit(s, s->config.max_open_documents);
+
+			// the server is still starting when NULL, done inside initialize_cb()
+			if (s->initialize_response)
+				apply_capabilities(s, s->initialize_response);
+			lsp_semtokens_init(s->filetype);
+		}
+		else
+		{
+			lsp_servers->pdata[i] = s_new;
+			stop_and_free_server(s);
+		}
+	}
+
+	g_key_file_free(kf);
+	g_key_file_free(kf_global);
+}
+
+
 gboolean lsp_server_uses_init_file(gchar *path)
 {
 	guint i;
@@ -1459,23 +2191,54 @@ gboolean lsp_server_uses_init_file(gchar *path)
 	{
 		LspServer *s = lsp_servers->pdata[i];
 
-		if (s->config.initialization_options_file)
-		{
-			gboolean found = FALSE;
-			gchar *p1 = utils_get_real_path(path);
-			gchar *p2 = utils_get_real_path(s->config.initialization_options_file);
+		if (uses_init_file(s, path))
+			return TRUE;
+	}
 
-			found = g_strcmp0(p1, p2) == 0;
+	return FALSE;
+}
 
-			g_free(p1);
-			g_free(p2);
 
-			if (found)
-				return TRUE;
+gchar *lsp_server_get_status(void)
+{
+	GString *str = g_string_new("");
+	guint i;
+
+	if (lsp_servers)
+	{
+		for (i = 0; i < lsp_servers->len; i++)
+		{
+			LspServer *s = lsp_servers->pdata[i];
+			LspProcStat stat;
+
+			if (!s->pid && !s->attached)
+				continue;
+
+			g_string_append_printf(str, "%s\n", s->config.cmd);
+			if (s->attached)
+				g_string_append_printf(str, "  attached to: %s\n", s->config.socket);
+			else
+			{
+				g_string_append_printf(str, "  pid: %d\n", (gint)s->pid);
+				if (lsp_procstat_read(s->pid, &stat))
+				{
+					g_string_append_printf(str, "  memory: %" G_GUINT64_FORMAT " MB\n", stat.rss_kb / 1024);
+					g_string_append_printf(str, "  cpu time: %.1f s\n", stat.cpu_ms / 1000.0);
+					g_string_append_printf(str, "  threads: %d\n", stat.threads);
+				}
+			}
+			g_string_append_printf(str, "  restarts: %u\n", s->restarts);
+			g_string_append_printf(str, "  open documents: %u", s->mru_docs.length);
+			if (s->config.max_open_documents > 0)
+				g_string_append_printf(str, " (limit %u)", s->open_docs_limit);
+			g_string_append(str, "\n\n");
 		}
 	}
 
-	return FALSE;
+	if (str->len == 0)
+		g_string_append(str, "No running LSP servers\n");
+
+	return g_string_free(str, FALSE);
 }
 
 
@@ -1496,14 +2259,17 @@ gchar *lsp_server_get_initialize_responses(void)
 
 		if (s->config.cmd && s->initialize_response)
 		{
+			gchar *response = lsp_utils_json_pretty_print(s->initialize_response);
+
 			if (!first)
 				g_string_append(str, "\n\n\"############################################################\": \"next server\",");
 			first = FALSE;
 			g_string_append(str, "\n\n\"");
 			g_string_append(str, s->config.cmd);
 			g_string_append(str, "\":\n");
-			g_string_append(str, s->initialize_response);
+			g_string_append(str, response);
 			g_string_append_c(str, ',');
+			g_free(response);
 		}
 	}
 	if (g_str_has_suffix(str->str, ","))
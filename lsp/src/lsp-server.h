@@ -32,6 +32,7 @@ typedef struct LspRpc LspRpc;
 typedef struct LspServerConfig
 {
 	gchar *cmd;
+	gchar *socket;
 	gchar **env;
 	gchar *ref_lang;
 	gchar **lang_id_mappings;
@@ -45,6 +46,8 @@ typedef struct LspServerConfig
 	gchar *initialization_options;
 	gchar **project_root_marker_patterns;
 	gboolean enable_by_default;
+	gboolean prewarm_on_project_open;
+	gboolean detach_on_quit;
 	gboolean use_outside_project_dir;
 	gboolean use_without_project;
 
@@ -84,6 +87,8 @@ typedef struct LspServerConfig
 	gchar *document_symbols_tab_label;
 	gboolean document_symbols_available;
 
+	gboolean symbol_index_enable;
+
 	gboolean semantic_tokens_enable;
 	gboolean semantic_tokens_force_full;
 	gchar **semantic_tokens_types;
@@ -109,6 +114,11 @@ typedef struct LspServerConfig
 	gboolean format_on_save;
 
 	gboolean progress_bar_enable;
+	gint idle_shutdown_minutes;
+	gint max_rss_mb;
+	gint pipe_buffer_size_kb;
+	gint max_open_documents;
+	gint reduce_open_documents_rss_mb;
 
 	gboolean execute_command_enable;
 	gboolean code_action_enable;
@@ -138,6 +148,8 @@ typedef struct LspServer
 	LspRpc *rpc;
 	//GSubprocess *process;
 	GPid pid;
+	gboolean attached;  // connected to an already running server over a socket
+	GCancellable *connect_cancellable;  // while connecting to the socket
 	GIOStream *stream;
 	LspLogInfo log;
 
@@ -145,19 +157,26 @@ typedef struct LspServer
 	gboolean not_used;
 	gboolean startup_shutdown;
 	guint restarts;
+	guint restart_source_id;
+	gboolean replaces_running;  // started once the replaced process stops
+	gint64 start_time;
+	gint64 idle_since;  // no documents open on the server since
 	gint filetype;
 
 	LspServerConfig config;
 
 	GHashTable *open_docs;
-	GSList *mru_docs;
+	GQueue mru_docs;  // least recently used first
+	guint open_docs_limit;
+	GPtrArray *reopen_docs;  // utf8 file names opened on the crashed server
 	GHashTable *diag_table;
 	GHashTable *wks_folder_table;
 	GSList *progress_ops;
+	GSList *partial_results;
 
 	gchar *autocomplete_trigger_chars;
 	gchar *signature_trigger_chars;
-	gchar *initialize_response;
+	GVariant *initialize_response;
 	gboolean use_incremental_sync;
 	gboolean send_did_save;
 	gboolean include_text_on_save;
@@ -175,16 +194,21 @@ LspServer *lsp_server_get_for_ft(GeanyFiletype *ft);
 LspServer *lsp_server_get_if_running(GeanyDocument *doc);
 LspServerConfig *lsp_server_get_all_section_config(void);
 gboolean lsp_server_is_usable(GeanyDocument *doc);
+gboolean lsp_server_is_alive(LspServer *srv);
 GeanyFiletype *lsp_server_get_ft(GeanyDocument *doc, gchar **lsp_lang_id);
+GeanyFiletype *lsp_server_get_ft_for_file(const gchar *locale_fname, GeanyFiletype *ft);
 void lsp_server_clear_cached_ft(GeanyDocument *doc);
 
-void lsp_server_stop_all(gboolean wait);
+void lsp_server_stop_all(gboolean wait, gboolean quitting);
+void lsp_server_connection_failed(LspServer *s);
 void lsp_server_init_all(void);
+void lsp_server_reload_config(const gchar *init_file);
 
 void lsp_server_set_initialized_cb(LspServerInitializedCallback cb);
 
 gboolean lsp_server_uses_init_file(gchar *path);
 
 gchar *lsp_server_get_initialize_responses(void);
+gchar *lsp_server_get_status(void);
 
 #endif  /* LSP_SERVER_H */
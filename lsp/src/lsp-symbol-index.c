@@ -0,0 +1,730 @@
+/*
+ * Copyright 2024 Jiri Techet <techet@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/* Per-project symbol index stored on disk so symbols of files which aren't
+ * open can be found before the server finishes indexing (or when the server
+ * doesn't support workspace symbols at all).
+ *
+ * File format (UTF-8, one record per line, fields separated by tabs):
+ *   LSPINDEX <version>
+ *   F <file>
+ *   S <filetype id> <kind> <icon> <line> <pos> <name> <scope>
+ * where S records belong to the preceding F record. The index is saved
+ * periodically when modified and files which no longer exist are dropped
+ * from it when the project is closed. */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "lsp-symbol-index.h"
+#include "lsp-symbol.h"
+#include "lsp-symbols.h"
+#include "lsp-symbol-kinds.h"
+#include "lsp-server.h"
+#include "lsp-utils.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+
+#define INDEX_HEADER "LSPINDEX\t1"
+
+#define SAVE_INTERVAL 300  /* s */
+
+
+typedef struct
+{
+	gchar *file;         /* utf8 */
+	GPtrArray *entries;  /* IndexEntry, parents before their children */
+	GPtrArray *sorted;   /* entries sorted by key, created when querying */
+	GHashTable *keys;    /* "line\tname" of entries, created when merging */
+} IndexFile;
+
+
+/* plain copies of symbol data so the index doesn't keep symbol trees of
+ * documents alive */
+typedef struct
+{
+	gchar *key;  /* normalized and casefolded name, computed when sorting */
+	gchar *name;
+	gchar *scope;  /* for entries without parent, otherwise built from parents */
+	gint parent;   /* index of the parent entry in the file, -1 if none */
+	IndexFile *f;
+	GeanyFiletypeID ft_id;
+	glong kind;
+	gulong line;
+	gulong pos;
+	guint icon;
+} IndexEntry;
+
+
+/* symbol of a document together with the index of its parent among the
+ * symbols of the file */
+typedef struct
+{
+	LspSymbol *sym;
+	gint parent;
+} FileSymbol;
+
+
+extern GeanyData *geany_data;
+extern GeanyPlugin *geany_plugin;
+
+static struct
+{
+	gchar *path;         /* locale */
+	GHashTable *files;   /* utf8 file name -> IndexFile */
+	gboolean modified;
+	guint save_source_id;
+} symbol_index;
+
+
+static gboolean save_cb(gpointer user_data);
+
+
+static IndexEntry *index_entry_new(IndexFile *f, const gchar *name, const gchar *scope,
+	gint parent, GeanyFiletypeID ft_id, glong kind, gulong line, gulong pos, guint icon)
+{
+	IndexEntry *entry = g_new0(IndexEntry, 1);
+
+	entry->name = g_strdup(name);
+	entry->scope = parent < 0 ? g_strdup(scope ? scope : "") : NULL;
+	entry->parent = parent;
+	entry->f = f;
+	entry->ft_id = ft_id;
+	entry->kind = kind;
+	entry->line = line;
+	entry->pos = pos;
+	entry->icon = icon;
+	return entry;
+}
+
+
+/* the scope of symbols without parent is just stored so nothing is computed */
+static IndexEntry *index_entry_new_from_symbol(IndexFile *f, LspSymbol *sym, gint parent)
+{
+	return index_entry_new(f, lsp_symbol_get_name(sym),
+		parent < 0 ? lsp_symbol_get_scope(sym) : NULL, parent,
+		lsp_symbol_get_ft_id(sym), lsp_symbol_get_kind(sym), lsp_symbol_get_line(sym),
+		lsp_symbol_get_pos(sym), lsp_symbol_get_icon(sym));
+}
+
+
+static void index_entry_free(IndexEntry *entry)
+{
+	g_free(entry->key);
+	g_free(entry->name);
+	g_free(entry->scope);
+	g_free(entry);
+}
+
+
+static gchar *get_entry_scope(IndexEntry *entry)
+{
+	IndexEntry *parent;
+	gchar *scope, *ret;
+
+	if (entry->parent < 0)
+		return g_strdup(entry->scope);
+
+	parent = entry->f->entries->pdata[entry->parent];
+	scope = get_entry_scope(parent);
+	if (EMPTY(scope))
+		ret = g_strdup(parent->name);
+	else
+		ret = g_strconcat(scope, LSP_SCOPE_SEPARATOR, parent->name, NULL);
+
+	g_free(scope);
+	return ret;
+}
+
+
+static IndexFile *index_file_new(const gchar *file)
+{
+	IndexFile *f = g_new0(IndexFile, 1);
+
+	f->file = g_strdup(file);
+	f->entries = g_ptr_array_new_full(0, (GDestroyNotify)index_entry_free);
+	return f;
+}
+
+
+static void index_file_free(IndexFile *f)
+{
+	if (f->keys)
+		g_hash_table_destroy(f->keys);
+	if (f->sorted)
+		g_ptr_array_free(f->sorted, TRUE);
+	g_ptr_array_free(f->entries, TRUE);
+	g_free(f->file);
+	g_free(f);
+}
+
+
+/* the key is owned by the IndexFile, g_hash_table_replace() replaces it too */
+static void add_index_file(IndexFile *f)
+{
+	g_hash_table_replace(symbol_index.files, f->file, f);
+	symbol_index.modified = TRUE;
+}
+
+
+static gint compare_entries(gconstpointer a, gconstpointer b)
+{
+	const IndexEntry *e1 = *((const IndexEntry **) a);
+	const IndexEntry *e2 = *((const IndexEntry **) b);
+
+	return strcmp(e1->key, e2->key);
+}
+
+
+/* only files which changed since the last query are sorted again */
+static void ensure_sorted(IndexFile *f)
+{
+	IndexEntry *entry;
+	guint i;
+
+	if (f->sorted)
+		return;
+
+	f->sorted = g_ptr_array_sized_new(f->entries->len);
+	foreach_ptr_array(entry, i, f->entries)
+	{
+		if (!entry->key)
+			entry->key = lsp_utils_normalize_casefold(entry->name);
+		g_ptr_array_add(f->sorted, entry);
+	}
+
+	g_ptr_array_sort(f->sorted, compare_entries);
+}
+
+
+static gboolean valid_field(const gchar *str)
+{
+	return str && !strpbrk(str, "\t\n\r");
+}
+
+
+static gchar *get_index_path(void)
+{
+	GeanyProject *project = geany_data->app->project;
+	gchar *checksum, *fname, *path;
+
+	if (!project || !project->file_name)
+		return NULL;
+
+	checksum = g_compute_checksum_for_string(G_CHECKSUM_MD5, project->file_name, -1);
+	fname = g_strconcat(checksum, ".idx", NULL);
+	path = g_build_filename(geany_data->app->configdir, "plugins", PLUGIN, "index", fname, NULL);
+
+	g_free(checksum);
+	g_free(fname);
+	return path;
+}
+
+
+static void parse_line(const gchar *line, IndexFile **f)
+{
+	gchar **fields = g_strsplit(line, "\t", -1);
+	guint len = g_strv_length(fields);
+
+	if (len == 2 && strcmp(fields[0], "F") == 0)
+	{
+		*f = index_file_new(fields[1]);
+		add_index_file(*f);
+	}
+	else if (len == 8 && strcmp(fields[0], "S") == 0 && *f)
+	{
+		g_ptr_array_add((*f)->entries, index_entry_new(*f, fields[6], fields[7], -1,
+			atoi(fields[1]), atol(fields[2]), strtoul(fields[4], NULL, 10),
+			strtoul(fields[5], NULL, 10), atoi(fields[3])));
+	}
+
+	g_strfreev(fields);
+}
+
+
+void lsp_symbol_index_load(void)
+{
+	LspServerConfig *cfg;
+	GMappedFile *file;
+	IndexFile *f = NULL;
+	const gchar *contents, *end, *p;
+	gboolean header_ok = FALSE;
+
+	lsp_symbol_index_save_and_free();
+
+	cfg = lsp_server_get_all_section_config();
+	if (!cfg || !cfg->symbol_index_enable)
+		return;
+
+	symbol_index.path = get_index_path();
+	if (!symbol_index.path)
+		return;
+
+	symbol_index.files = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+		(GDestroyNotify)index_file_free);
+	symbol_index.save_source_id = plugin_timeout_add(geany_plugin, SAVE_INTERVAL * 1000,
+		save_cb, NULL);
+
+	file = g_mapped_file_new(symbol_index.path, FALSE, NULL);
+	if (file)
+	{
+		contents = g_mapped_file_get_contents(file);
+		end = contents + g_mapped_file_get_length(file);
+
+		for (p = contents; p && p < end;)
+		{
+			const gchar *eol = memchr(p, '\n', end - p);
+			gchar *line = g_strndup(p, eol ? eol - p : end - p);
+
+			if (!header_ok)
+			{
+				header_ok = strcmp(line, INDEX_HEADER) == 0;
+				g_free(line);
+				if (!header_ok)
+					break;
+			}
+			else
+			{
+				if (g_utf8_validate(line, -1, NULL))
+					parse_line(line, &f);
+				g_free(line);
+			}
+
+			p = eol ? eol + 1 : NULL;
+		}
+
+		g_mapped_file_unref(file);
+	}
+
+	symbol_index.modified = FALSE;
+}
+
+
+/* drops files which were deleted or renamed */
+static void prune_index(void)
+{
+	GHashTableIter iter;
+	gpointer val;
+
+	g_hash_table_iter_init(&iter, symbol_index.files);
+	while (g_hash_table_iter_next(&iter, NULL, &val))
+	{
+		IndexFile *f = val;
+		gchar *locale_file = utils_get_locale_from_utf8(f->file);
+
+		if (f->entries->len == 0 || !g_file_test(locale_file, G_FILE_TEST_EXISTS))
+		{
+			g_hash_table_iter_remove(&iter);
+			symbol_index.modified = TRUE;
+		}
+		g_free(locale_file);
+	}
+}
+
+
+static void save_index(void)
+{
+	GString *str;
+	GHashTableIter iter;
+	gpointer val;
+	gchar *dirname;
+
+	if (!symbol_index.files || !symbol_index.path || !symbol_index.modified)
+		return;
+
+	str = g_string_new(INDEX_HEADER"\n");
+
+	g_hash_table_iter_init(&iter, symbol_index.files);
+	while (g_hash_table_iter_next(&iter, NULL, &val))
+	{
+		IndexFile *f = val;
+		IndexEntry *entry;
+		guint i;
+
+		if (!valid_field(f->file))
+			continue;
+
+		g_string_append_printf(str, "F\t%s\n", f->file);
+		foreach_ptr_array(entry, i, f->entries)
+		{
+			gchar *scope = get_entry_scope(entry);
+
+			if (valid_field(entry->name) && valid_field(scope))
+			{
+				g_string_append_printf(str, "S\t%d\t%ld\t%u\t%lu\t%lu\t%s\t%s\n",
+					entry->ft_id, entry->kind, entry->icon, entry->line, entry->pos,
+					entry->name, scope);
+			}
+			g_free(scope);
+		}
+	}
+
+	dirname = g_path_get_dirname(symbol_index.path);
+	utils_mkdir(dirname, TRUE);
+	if (!g_file_set_contents(symbol_index.path, str->str, str->len, NULL))
+		msgwin_status_add(_("Cannot write LSP symbol index %s"), symbol_index.path);
+	else
+		symbol_index.modified = FALSE;
+
+	g_free(dirname);
+	g_string_free(str, TRUE);
+}
+
+
+/* so the index isn't lost when Geany crashes */
+static gboolean save_cb(gpointer user_data)
+{
+	save_index();
+	return G_SOURCE_CONTINUE;
+}
+
+
+void lsp_symbol_index_save_and_free(void)
+{
+	if (symbol_index.files)
+		prune_index();
+	save_index();
+
+	if (symbol_index.save_source_id)
+		g_source_remove(symbol_index.save_source_id);
+	if (symbol_index.files)
+		g_hash_table_destroy(symbol_index.files);
+	g_free(symbol_index.path);
+
+	symbol_index.save_source_id = 0;
+	symbol_index.files = NULL;
+	symbol_index.path = NULL;
+	symbol_index.modified = FALSE;
+}
+
+
+/* symbols of @file in @symbols which are stored in pre-order */
+static GArray *get_file_symbols(const gchar *file, GPtrArray *symbols)
+{
+	GArray *ret = g_array_new(FALSE, FALSE, sizeof(FileSymbol));
+	GArray *ancestors = g_array_new(FALSE, FALSE, sizeof(gint));
+	LspSymbol *sym;
+	guint i;
+
+	foreach_ptr_array(sym, i, symbols)
+	{
+		LspSymbol *parent = lsp_symbol_get_parent(sym);
+		FileSymbol fs = {sym, -1};
+		gint idx;
+
+		if (g_strcmp0(lsp_symbol_get_file(sym), file) != 0)
+			continue;
+
+		while (ancestors->len > 0)
+		{
+			idx = g_array_index(ancestors, gint, ancestors->len - 1);
+			if (g_array_index(ret, FileSymbol, idx).sym == parent)
+				break;
+			g_array_set_size(ancestors, ancestors->len - 1);
+		}
+		if (ancestors->len > 0)
+			fs.parent = g_array_index(ancestors, gint, ancestors->len - 1);
+
+		idx = ret->len;
+		g_array_append_val(ret, fs);
+		g_array_append_val(ancestors, idx);
+	}
+
+	g_array_free(ancestors, TRUE);
+	return ret;
+}
+
+
+static gboolean entries_equal(IndexFile *f, GArray *file_symbols)
+{
+	guint i;
+
+	if (f->entries->len != file_symbols->len)
+		return FALSE;
+
+	for (i = 0; i < file_symbols->len; i++)
+	{
+		FileSymbol *fs = &g_array_index(file_symbols, FileSymbol, i);
+		IndexEntry *entry = f->entries->pdata[i];
+
+		if (entry->parent != fs->parent ||
+			entry->line != lsp_symbol_get_line(fs->sym) ||
+			entry->pos != lsp_symbol_get_pos(fs->sym) ||
+			entry->kind != lsp_symbol_get_kind(fs->sym) ||
+			g_strcmp0(entry->name, lsp_symbol_get_name(fs->sym)) != 0)
+			return FALSE;
+
+		if (fs->parent < 0)
+		{
+			// no parent so nothing gets computed
+			const gchar *scope = lsp_symbol_get_scope(fs->sym);
+
+			if (g_strcmp0(entry->scope, scope ? scope : "") != 0)
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+
+/* replaces all symbols of the given file when they differ from the indexed ones */
+void lsp_symbol_index_update_file(const gchar *file, GPtrArray *symbols)
+{
+	GArray *file_symbols;
+	IndexFile *f;
+	guint i;
+
+	if (!symbol_index.files || !file || !symbols)
+		return;
+
+	file_symbols = get_file_symbols(file, symbols);
+	f = g_hash_table_lookup(symbol_index.files, file);
+
+	if (!f || !entries_equal(f, file_symbols))
+	{
+		f = index_file_new(file);
+		for (i = 0; i < file_symbols->len; i++)
+		{
+			FileSymbol *fs = &g_array_index(file_symbols, FileSymbol, i);
+
+			g_ptr_array_add(f->entries, index_entry_new_from_symbol(f, fs->sym, fs->parent));
+		}
+		add_index_file(f);
+	}
+
+	g_array_free(file_symbols, TRUE);
+}
+
+
+static gchar *get_entry_key(gulong line, const gchar *name)
+{
+	return g_strdup_printf("%lu\t%s", line, name);
+}
+
+
+/* adds the symbol unless the file already contains a symbol with the same
+ * name at the same line */
+static gboolean add_to_file(IndexFile *f, LspSymbol *sym)
+{
+	gchar *key;
+
+	if (!f->keys)
+	{
+		IndexEntry *entry;
+		guint i;
+
+		f->keys = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+		foreach_ptr_array(entry, i, f->entries)
+			g_hash_table_add(f->keys, get_entry_key(entry->line, entry->name));
+	}
+
+	key = get_entry_key(lsp_symbol_get_line(sym), lsp_symbol_get_name(sym));
+	if (g_hash_table_contains(f->keys, key))
+	{
+		g_free(key);
+		return FALSE;
+	}
+
+	g_hash_table_add(f->keys, key);
+	g_ptr_array_add(f->entries, index_entry_new_from_symbol(f, sym, -1));
+	if (f->sorted)
+		g_ptr_array_free(f->sorted, TRUE);
+	f->sorted = NULL;
+	return TRUE;
+}
+
+
+/* merges symbols from (possibly partial) results such as workspace/symbol */
+void lsp_symbol_index_add(GPtrArray *symbols)
+{
+	LspSymbol *sym;
+	guint i;
+
+	if (!symbol_index.files || !symbols)
+		return;
+
+	foreach_ptr_array(sym, i, symbols)
+	{
+		const gchar *file = lsp_symbol_get_file(sym);
+		IndexFile *f;
+
+		if (!file)
+			continue;
+
+		f = g_hash_table_lookup(symbol_index.files, file);
+		if (!f)
+		{
+			f = index_file_new(file);
+			add_index_file(f);
+		}
+
+		if (add_to_file(f, sym))
+			symbol_index.modified = TRUE;
+	}
+}
+
+
+static void update_from_tm_tags(GeanyDocument *doc, const gchar *file)
+{
+	IndexFile *f = index_file_new(file);
+	TMTag *tag;
+	guint i;
+
+	foreach_ptr_array(tag, i, doc->tm_file->tags_array)
+	{
+		LspSymbolKind kind;
+
+		if (tag->type == tm_tag_local_var_t)
+			continue;
+
+		kind = lsp_symbol_kinds_tm_to_lsp(tag->type);
+		g_ptr_array_add(f->entries, index_entry_new(f, tag->name, tag->scope, -1,
+			doc->file_type->id, kind, tag->line, 0, lsp_symbol_kinds_get_symbol_icon(kind)));
+	}
+
+	add_index_file(f);
+}
+
+
+/* called on save to keep the index of the document up to date; symbols are
+ * never requested just for the index - a stale cache gets indexed when
+ * the symbols are fetched next time, see lsp_symbols_doc_request() */
+void lsp_symbol_index_update_doc(GeanyDocument *doc)
+{
+	LspServer *srv;
+	gchar *file;
+
+	if (!symbol_index.files || !doc->real_path)
+		return;
+
+	srv = lsp_server_get_if_running(doc);
+	file = utils_get_utf8_from_locale(doc->real_path);
+
+	if (srv && srv->config.document_symbols_available)
+	{
+		if (lsp_symbols_doc_cache_valid(doc))
+			lsp_symbol_index_update_file(file, lsp_symbols_doc_get_cached(doc));
+	}
+	else if (doc->tm_file)
+		update_from_tm_tags(doc, file);
+
+	g_free(file);
+}
+
+
+static guint lower_bound(GPtrArray *sorted, const gchar *key)
+{
+	guint lo = 0;
+	guint hi = sorted->len;
+
+	while (lo < hi)
+	{
+		guint mid = lo + (hi - lo) / 2;
+		IndexEntry *entry = sorted->pdata[mid];
+
+		if (strcmp(entry->key, key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+
+/* the scope is only built for returned symbols */
+static LspSymbol *new_symbol(IndexEntry *entry)
+{
+	gchar *scope = get_entry_scope(entry);
+	LspSymbol *sym = lsp_symbol_new(entry->name, "", scope, entry->f->file, entry->ft_id,
+		entry->kind, entry->line, entry->pos, entry->icon);
+
+	g_free(scope);
+	return sym;
+}
+
+
+/* returns symbols whose names start with query followed by those containing
+ * it, at most max_num of them */
+GPtrArray *lsp_symbol_index_query(GeanyFiletypeID ft_id, const gchar *query, guint max_num)
+{
+	GPtrArray *ret = g_ptr_array_new_full(0, (GDestroyNotify)lsp_symbol_unref);
+	GPtrArray *prefixed;
+	GHashTableIter iter;
+	gpointer val;
+	IndexEntry *entry;
+	gchar *key;
+	guint i;
+
+	if (!symbol_index.files)
+		return ret;
+
+	key = lsp_utils_normalize_casefold(query);
+	prefixed = g_ptr_array_new();
+
+	// prefix matches of all files, sorted together
+	g_hash_table_iter_init(&iter, symbol_index.files);
+	while (g_hash_table_iter_next(&iter, NULL, &val))
+	{
+		IndexFile *f = val;
+
+		ensure_sorted(f);
+		for (i = lower_bound(f->sorted, key); i < f->sorted->len; i++)
+		{
+			entry = f->sorted->pdata[i];
+
+			if (!g_str_has_prefix(entry->key, key))
+				break;
+			if (entry->ft_id == ft_id)
+				g_ptr_array_add(prefixed, entry);
+		}
+	}
+
+	g_ptr_array_sort(prefixed, compare_entries);
+	foreach_ptr_array(entry, i, prefixed)
+	{
+		if (ret->len >= max_num)
+			break;
+		g_ptr_array_add(ret, new_symbol(entry));
+	}
+
+	g_hash_table_iter_init(&iter, symbol_index.files);
+	while (*key && ret->len < max_num && g_hash_table_iter_next(&iter, NULL, &val))
+	{
+		IndexFile *f = val;
+
+		foreach_ptr_array(entry, i, f->sorted)
+		{
+			if (ret->len >= max_num)
+				break;
+			if (entry->ft_id == ft_id && !g_str_has_prefix(entry->key, key) &&
+				strstr(entry->key, key))
+			{
+				g_ptr_array_add(ret, new_symbol(entry));
+			}
+		}
+	}
+
+	g_ptr_array_free(prefixed, TRUE);
+	g_free(key);
+	return ret;
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright 2024 Jiri Techet <techet@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef LSP_SYMBOL_INDEX_H
+#define LSP_SYMBOL_INDEX_H 1
+
+#include <geanyplugin.h>
+#include <glib.h>
+
+void lsp_symbol_index_load(void);
+void lsp_symbol_index_save_and_free(void);
+
+void lsp_symbol_index_update_file(const gchar *file, GPtrArray *symbols);
+void lsp_symbol_index_add(GPtrArray *symbols);
+void lsp_symbol_index_update_doc(GeanyDocument *doc);
+
+GPtrArray *lsp_symbol_index_query(GeanyFiletypeID ft_id, const gchar *query, guint max_num);
+
+#endif  /* LSP_SYMBOL_INDEX_H */
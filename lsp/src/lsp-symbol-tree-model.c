@@ -0,0 +1,669 @@
+/*
+ * Copyright 2024 Jiri Techet <techet@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/* GtkTreeModel exposing the document symbol hierarchy to the symbol tree
+ * without copying it into a GtkTreeStore. Rows only reference the symbols,
+ * displayed names and tooltips are created when the view asks for them. */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <geanyplugin.h>
+
+#include "lsp-symbol-tree-model.h"
+#include "lsp-symbol.h"
+#include "lsp-utils.h"
+
+#include <string.h>
+
+
+typedef enum
+{
+	NODE_INSERTED,
+	NODE_CHANGED,
+	NODE_HAS_CHILD_TOGGLED
+} NodeSignal;
+
+
+typedef struct Node
+{
+	LspSymbol *sym;
+	struct Node *parent;
+	GSequence *children;  /* sorted Node*, NULL when there never were any */
+	GSequenceIter *seq_iter;  /* position in the parent's children */
+	gboolean show_scope;  /* displayed outside of its parent because of filtering */
+} Node;
+
+
+struct _LspSymbolTreeModel
+{
+	GObject parent_instance;
+
+	Node *root;
+	gint stamp;
+	gchar *encoding;
+
+	GPtrArray *symbols;    /* symbols the model was last updated with */
+	gchar *filter;         /* normalized and casefolded filter */
+	gchar **terms;         /* non-empty terms of filter */
+	GHashTable *rejected;  /* symbols from @symbols not matching @filter */
+};
+
+
+static void lsp_symbol_tree_model_tree_model_init(GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(LspSymbolTreeModel, lsp_symbol_tree_model, G_TYPE_OBJECT,
+	G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL, lsp_symbol_tree_model_tree_model_init))
+
+
+static void node_free(Node *node)
+{
+	if (node->children)
+		g_sequence_free(node->children);
+	if (node->sym)
+		lsp_symbol_unref(node->sym);
+	g_free(node);
+}
+
+
+static Node *node_new(LspSymbol *sym, Node *parent)
+{
+	Node *node = g_new0(Node, 1);
+
+	node->sym = lsp_symbol_ref(sym);
+	node->parent = parent;
+	node->show_scope = lsp_symbol_get_parent(sym) != parent->sym;
+
+	return node;
+}
+
+
+static gboolean node_has_children(Node *node)
+{
+	return node->children && !g_sequence_is_empty(node->children);
+}
+
+
+static void node_append(Node *parent, Node *node)
+{
+	if (!parent->children)
+		parent->children = g_sequence_new((GDestroyNotify)node_free);
+	node->seq_iter = g_sequence_append(parent->children, node);
+}
+
+
+static gboolean set_iter(LspSymbolTreeModel *model, GtkTreeIter *iter, Node *node)
+{
+	if (!node)
+	{
+		iter->stamp = 0;
+		return FALSE;
+	}
+
+	iter->stamp = model->stamp;
+	iter->user_data = node;
+	return TRUE;
+}
+
+
+static Node *get_node(LspSymbolTreeModel *model, GtkTreeIter *iter)
+{
+	if (!iter)
+		return model->root;
+
+	g_return_val_if_fail(iter->stamp == model->stamp, NULL);
+	return iter->user_data;
+}
+
+
+static GtkTreePath *get_node_path(Node *node)
+{
+	GtkTreePath *path = gtk_tree_path_new();
+
+	for (; node->parent; node = node->parent)
+		gtk_tree_path_prepend_index(path, g_sequence_iter_get_position(node->seq_iter));
+
+	return path;
+}
+
+
+static GtkTreeModelFlags tree_model_get_flags(GtkTreeModel *tree_model)
+{
+	return GTK_TREE_MODEL_ITERS_PERSIST;
+}
+
+
+static gint tree_model_get_n_columns(GtkTreeModel *tree_model)
+{
+	return SYMBOLS_N_COLUMNS;
+}
+
+
+static GType tree_model_get_column_type(GtkTreeModel *tree_model, gint index)
+{
+	switch (index)
+	{
+		case SYMBOLS_COLUMN_ICON:
+			return GDK_TYPE_PIXBUF;
+		case SYMBOLS_COLUMN_SYMBOL:
+			return LSP_TYPE_SYMBOL;
+		case SYMBOLS_COLUMN_NAME:
+		case SYMBOLS_COLUMN_TOOLTIP:
+			return G_TYPE_STRING;
+	}
+
+	g_return_val_if_reached(G_TYPE_INVALID);
+}
+
+
+static gboolean tree_model_get_iter(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreePath *path)
+{
+	LspSymbolTreeModel *model = LSP_SYMBOL_TREE_MODEL(tree_model);
+	gint *indices = gtk_tree_path_get_indices(path);
+	gint depth = gtk_tree_path_get_depth(path);
+	Node *node = model->root;
+	gint i;
+
+	for (i = 0; i < depth; i++)
+	{
+		if (!node->children || indices[i] >= g_sequence_get_length(node->children))
+			return set_iter(model, iter, NULL);
+		node = g_sequence_get(g_sequence_get_iter_at_pos(node->children, indices[i]));
+	}
+
+	return set_iter(model, iter, depth > 0 ? node : NULL);
+}
+
+
+static GtkTreePath *tree_model_get_path(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	Node *node = get_node(LSP_SYMBOL_TREE_MODEL(tree_model), iter);
+
+	g_return_val_if_fail(node, NULL);
+
+	return get_node_path(node);
+}
+
+
+static void tree_model_get_value(GtkTreeModel *tree_model, GtkTreeIter *iter, gint column, GValue *value)
+{
+	LspSymbolTreeModel *model = LSP_SYMBOL_TREE_MODEL(tree_model);
+	Node *node = get_node(model, iter);
+
+	g_value_init(value, tree_model_get_column_type(tree_model, column));
+	g_return_if_fail(node && node->sym);
+
+	switch (column)
+	{
+		case SYMBOLS_COLUMN_ICON:
+			g_value_set_object(value, symbols_get_icon_pixbuf(lsp_symbol_get_icon(node->sym)));
+			break;
+		case SYMBOLS_COLUMN_NAME:
+			g_value_take_string(value, lsp_symbol_get_symtree_name(node->sym, node->show_scope));
+			break;
+		case SYMBOLS_COLUMN_SYMBOL:
+			g_value_set_boxed(value, node->sym);
+			break;
+		case SYMBOLS_COLUMN_TOOLTIP:
+			g_value_take_string(value, lsp_symbol_get_symtree_tooltip(node->sym, model->encoding));
+			break;
+	}
+}
+
+
+static gboolean tree_model_iter_next(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	LspSymbolTreeModel *model = LSP_SYMBOL_TREE_MODEL(tree_model);
+	Node *node = get_node(model, iter);
+	GSequenceIter *next;
+
+	g_return_val_if_fail(node, FALSE);
+
+	next = g_sequence_iter_next(node->seq_iter);
+	return set_iter(model, iter, g_sequence_iter_is_end(next) ? NULL : g_sequence_get(next));
+}
+
+
+static gboolean tree_model_iter_previous(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	LspSymbolTreeModel *model = LSP_SYMBOL_TREE_MODEL(tree_model);
+	Node *node = get_node(model, iter);
+
+	g_return_val_if_fail(node, FALSE);
+
+	if (g_sequence_iter_is_begin(node->seq_iter))
+		return set_iter(model, iter, NULL);
+	return set_iter(model, iter, g_sequence_get(g_sequence_iter_prev(node->seq_iter)));
+}
+
+
+static gboolean tree_model_iter_nth_child(GtkTreeModel *tree_model, GtkTreeIter *iter,
+	GtkTreeIter *parent, gint n)
+{
+	LspSymbolTreeModel *model = LSP_SYMBOL_TREE_MODEL(tree_model);
+	Node *node = get_node(model, parent);
+
+	if (!node || !node->children || n < 0 || n >= g_sequence_get_length(node->children))
+		return set_iter(model, iter, NULL);
+
+	return set_iter(model, iter, g_sequence_get(g_sequence_get_iter_at_pos(node->children, n)));
+}
+
+
+static gboolean tree_model_iter_children(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent)
+{
+	return tree_model_iter_nth_child(tree_model, iter, parent, 0);
+}
+
+
+static gboolean tree_model_iter_has_child(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	Node *node = get_node(LSP_SYMBOL_TREE_MODEL(tree_model), iter);
+
+	return node && node_has_children(node);
+}
+
+
+static gint tree_model_iter_n_children(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	Node *node = get_node(LSP_SYMBOL_TREE_MODEL(tree_model), iter);
+
+	if (!node || !node->children)
+		return 0;
+	return g_sequence_get_length(node->children);
+}
+
+
+static gboolean tree_model_iter_parent(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *child)
+{
+	LspSymbolTreeModel *model = LSP_SYMBOL_TREE_MODEL(tree_model);
+	Node *node = get_node(model, child);
+
+	if (!node || !node->parent || node->parent == model->root)
+		return set_iter(model, iter, NULL);
+	return set_iter(model, iter, node->parent);
+}
+
+
+static void lsp_symbol_tree_model_tree_model_init(GtkTreeModelIface *iface)
+{
+	iface->get_flags = tree_model_get_flags;
+	iface->get_n_columns = tree_model_get_n_columns;
+	iface->get_column_type = tree_model_get_column_type;
+	iface->get_iter = tree_model_get_iter;
+	iface->get_path = tree_model_get_path;
+	iface->get_value = tree_model_get_value;
+	iface->iter_next = tree_model_iter_next;
+	iface->iter_previous = tree_model_iter_previous;
+	iface->iter_children = tree_model_iter_children;
+	iface->iter_has_child = tree_model_iter_has_child;
+	iface->iter_n_children = tree_model_iter_n_children;
+	iface->iter_nth_child = tree_model_iter_nth_child;
+	iface->iter_parent = tree_model_iter_parent;
+}
+
+
+static void lsp_symbol_tree_model_finalize(GObject *object)
+{
+	LspSymbolTreeModel *model = LSP_SYMBOL_TREE_MODEL(object);
+
+	node_free(model->root);
+	g_free(model->encoding);
+	g_free(model->filter);
+	g_strfreev(model->terms);
+	g_hash_table_destroy(model->rejected);
+	if (model->symbols)
+		g_ptr_array_unref(model->symbols);
+
+	G_OBJECT_CLASS(lsp_symbol_tree_model_parent_class)->finalize(object);
+}
+
+
+static void lsp_symbol_tree_model_class_init(LspSymbolTreeModelClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+	object_class->finalize = lsp_symbol_tree_model_finalize;
+}
+
+
+static void lsp_symbol_tree_model_init(LspSymbolTreeModel *model)
+{
+	model->root = g_new0(Node, 1);
+	model->stamp = g_random_int();
+	model->terms = g_new0(gchar *, 1);
+	model->rejected = g_hash_table_new(NULL, NULL);
+}
+
+
+LspSymbolTreeModel *lsp_symbol_tree_model_new(void)
+{
+	return g_object_new(LSP_TYPE_SYMBOL_TREE_MODEL, NULL);
+}
+
+
+/* sort by line, then name */
+static gint compare_symbol_lines(gconstpointer a, gconstpointer b)
+{
+	const LspSymbol *sym_a = *((LspSymbol **) a);
+	const LspSymbol *sym_b = *((LspSymbol **) b);
+	gint ret;
+
+	ret = lsp_symbol_get_line(sym_a) - lsp_symbol_get_line(sym_b);
+	if (ret == 0)
+		return g_strcmp0(lsp_symbol_get_name(sym_a), lsp_symbol_get_name(sym_b));
+	return ret;
+}
+
+
+/* Each filter term has to be found in the search key of the symbol or
+ * of some of its parents. Symbols rejected by the previous filter are
+ * remembered so they don't have to be tested again when the filter only
+ * gets narrower. */
+static gboolean symbol_matches_filter(LspSymbolTreeModel *model, LspSymbol *sym)
+{
+	gchar **val;
+
+	if (!model->terms[0])
+		return TRUE;
+
+	if (g_hash_table_contains(model->rejected, sym))
+		return FALSE;
+
+	foreach_strv(val, model->terms)
+	{
+		LspSymbol *s;
+
+		for (s = sym; s; s = lsp_symbol_get_parent(s))
+		{
+			if (strstr(lsp_symbol_get_search_key(s), *val))
+				break;
+		}
+
+		if (!s)
+		{
+			g_hash_table_add(model->rejected, sym);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+
+/* Collects symbols displayed directly below a row whose children are
+ * @symbols. Filtered-out symbols are skipped and their matching descendants
+ * are moved one level up in their place. */
+static void collect_visible_symbols(LspSymbolTreeModel *model, GPtrArray *symbols, GPtrArray *visible)
+{
+	LspSymbol *sym;
+	guint i;
+
+	if (!symbols)
+		return;
+
+	foreach_ptr_array(sym, i, symbols)
+	{
+		if (symbol_matches_filter(model, sym))
+			g_ptr_array_add(visible, sym);
+		else
+			collect_visible_symbols(model, lsp_symbol_get_children(sym), visible);
+	}
+}
+
+
+static GPtrArray *get_visible_symbols(LspSymbolTreeModel *model, GPtrArray *symbols)
+{
+	GPtrArray *visible = g_ptr_array_new();
+
+	collect_visible_symbols(model, symbols, visible);
+	g_ptr_array_sort(visible, compare_symbol_lines);
+
+	return visible;
+}
+
+
+/* symbols are compared within a single tree level so scope doesn't matter */
+static gboolean symbols_table_equal(gconstpointer v1, gconstpointer v2)
+{
+	const LspSymbol *s1 = v1;
+	const LspSymbol *s2 = v2;
+
+	return (lsp_symbol_get_kind(s1) == lsp_symbol_get_kind(s2) &&
+			strcmp(lsp_symbol_get_name(s1), lsp_symbol_get_name(s2)) == 0 &&
+			/* include arglist in match to support e.g. C++ overloading */
+			utils_str_equal(lsp_symbol_get_detail(s1), lsp_symbol_get_detail(s2)));
+}
+
+
+/* inspired by g_str_hash() */
+static guint symbols_table_hash(gconstpointer v)
+{
+	const LspSymbol *sym = v;
+	const gchar *p;
+	guint32 h = 5381;
+
+	h = (h << 5) + h + lsp_symbol_get_kind(sym);
+	for (p = lsp_symbol_get_name(sym); *p != '\0'; p++)
+		h = (h << 5) + h + *p;
+	/* for e.g. C++ overloading */
+	if (lsp_symbol_get_detail(sym))
+	{
+		for (p = lsp_symbol_get_detail(sym); *p != '\0'; p++)
+			h = (h << 5) + h + *p;
+	}
+
+	return h;
+}
+
+
+static guint symbols_table_count(GHashTable *table, LspSymbol *sym)
+{
+	return GPOINTER_TO_UINT(g_hash_table_lookup(table, sym));
+}
+
+
+static void symbols_table_add(GHashTable *table, LspSymbol *sym, gint diff)
+{
+	g_hash_table_insert(table, sym, GUINT_TO_POINTER(symbols_table_count(table, sym) + diff));
+}
+
+
+/* creates the subtree of a new row, no signals are needed as the view only
+ * asks for the children of rows once it expands them */
+static void build_children(LspSymbolTreeModel *model, Node *node)
+{
+	GPtrArray *visible = get_visible_symbols(model, lsp_symbol_get_children(node->sym));
+	LspSymbol *sym;
+	guint i;
+
+	foreach_ptr_array(sym, i, visible)
+	{
+		Node *child = node_new(sym, node);
+
+		node_append(node, child);
+		build_children(model, child);
+	}
+
+	g_ptr_array_free(visible, TRUE);
+}
+
+
+static void emit_node_signal(LspSymbolTreeModel *model, Node *node, NodeSignal signal)
+{
+	GtkTreePath *path = get_node_path(node);
+	GtkTreeIter iter;
+
+	set_iter(model, &iter, node);
+	switch (signal)
+	{
+		case NODE_INSERTED:
+			gtk_tree_model_row_inserted(GTK_TREE_MODEL(model), path, &iter);
+			if (node_has_children(node))
+				gtk_tree_model_row_has_child_toggled(GTK_TREE_MODEL(model), path, &iter);
+			break;
+		case NODE_CHANGED:
+			gtk_tree_model_row_changed(GTK_TREE_MODEL(model), path, &iter);
+			break;
+		case NODE_HAS_CHILD_TOGGLED:
+			gtk_tree_model_row_has_child_toggled(GTK_TREE_MODEL(model), path, &iter);
+			break;
+	}
+	gtk_tree_path_free(path);
+}
+
+
+static void update_level(LspSymbolTreeModel *model, Node *parent, GPtrArray *symbols);
+
+
+static void update_node(LspSymbolTreeModel *model, Node *node, LspSymbol *sym)
+{
+	gboolean show_scope = lsp_symbol_get_parent(sym) != node->parent->sym;
+	gboolean changed = show_scope != node->show_scope || !lsp_symbol_equal(node->sym, sym);
+
+	lsp_symbol_unref(node->sym);
+	node->sym = lsp_symbol_ref(sym);
+	node->show_scope = show_scope;
+
+	if (changed)
+		emit_node_signal(model, node, NODE_CHANGED);
+
+	update_level(model, node, lsp_symbol_get_children(sym));
+}
+
+
+/*
+ * Updates children of @parent so they correspond to the visible part of
+ * @symbols. Both the rows and the new symbols are sorted so they are merged
+ * in a single pass: rows whose symbol still exists are kept (so the view
+ * preserves their expansion and selection), the rest is removed and new rows
+ * are inserted at their sorted position.
+ */
+static void update_level(LspSymbolTreeModel *model, Node *parent, GPtrArray *symbols)
+{
+	GPtrArray *visible = get_visible_symbols(model, symbols);
+	gboolean had_children = node_has_children(parent);
+	/* GHashTable<LspSymbol, count> - new symbols not consumed yet */
+	GHashTable *remaining = g_hash_table_new(symbols_table_hash, symbols_table_equal);
+	GSequenceIter *seq_iter;
+	LspSymbol *sym;
+	guint i;
+
+	foreach_ptr_array(sym, i, visible)
+		symbols_table_add(remaining, sym, 1);
+
+	if (!parent->children && visible->len > 0)
+		parent->children = g_sequence_new((GDestroyNotify)node_free);
+
+	seq_iter = parent->children ? g_sequence_get_begin_iter(parent->children) : NULL;
+	i = 0;
+	while ((seq_iter && !g_sequence_iter_is_end(seq_iter)) || i < visible->len)
+	{
+		Node *node = seq_iter && !g_sequence_iter_is_end(seq_iter) ? g_sequence_get(seq_iter) : NULL;
+
+		sym = i < visible->len ? visible->pdata[i] : NULL;
+
+		if (node && sym && symbols_table_equal(node->sym, sym))
+		{
+			symbols_table_add(remaining, sym, -1);
+			update_node(model, node, sym);
+			seq_iter = g_sequence_iter_next(seq_iter);
+			i++;
+		}
+		else if (node && symbols_table_count(remaining, node->sym) == 0)
+		{
+			GSequenceIter *next = g_sequence_iter_next(seq_iter);
+			GtkTreePath *path = get_node_path(node);
+
+			g_sequence_remove(seq_iter);
+			gtk_tree_model_row_deleted(GTK_TREE_MODEL(model), path);
+			gtk_tree_path_free(path);
+			seq_iter = next;
+		}
+		else
+		{
+			Node *new_node = node_new(sym, parent);
+
+			symbols_table_add(remaining, sym, -1);
+			build_children(model, new_node);
+			new_node->seq_iter = g_sequence_insert_before(seq_iter, new_node);
+			emit_node_signal(model, new_node, NODE_INSERTED);
+			i++;
+		}
+	}
+
+	if (parent != model->root && had_children != node_has_children(parent))
+		emit_node_signal(model, parent, NODE_HAS_CHILD_TOGGLED);
+
+	g_hash_table_destroy(remaining);
+	g_ptr_array_free(visible, TRUE);
+}
+
+
+void lsp_symbol_tree_model_update(LspSymbolTreeModel *model, GPtrArray *symbols,
+	const gchar *filter, const gchar *encoding)
+{
+	gchar *case_normalized_filter = lsp_utils_normalize_casefold(filter ? filter : "");
+	GPtrArray *roots = g_ptr_array_new();
+	gchar **terms, **val;
+	LspSymbol *sym;
+	guint i;
+
+	/* When the filter was only extended, every term is either an old term,
+	 * an old term with more characters or a new term - symbols rejected by the
+	 * old filter stay rejected. Anything else invalidates the rejected set. */
+	if (symbols != model->symbols || !model->filter ||
+		!g_str_has_prefix(case_normalized_filter, model->filter))
+	{
+		g_hash_table_remove_all(model->rejected);
+	}
+
+	if (symbols != model->symbols)
+	{
+		if (model->symbols)
+			g_ptr_array_unref(model->symbols);
+		/* only compared by address, the reference prevents its reuse */
+		model->symbols = g_ptr_array_ref(symbols);
+	}
+
+	SETPTR(model->filter, case_normalized_filter);
+	SETPTR(model->encoding, g_strdup(encoding));
+
+	/* skip empty terms so an empty filter has no terms at all */
+	terms = g_strsplit_set(model->filter, " ", -1);
+	g_strfreev(model->terms);
+	model->terms = g_new0(gchar *, g_strv_length(terms) + 1);
+	i = 0;
+	foreach_strv(val, terms)
+	{
+		if (**val)
+			model->terms[i++] = g_strdup(*val);
+	}
+	g_strfreev(terms);
+
+	foreach_ptr_array(sym, i, symbols)
+	{
+		if (!lsp_symbol_get_parent(sym))
+			g_ptr_array_add(roots, sym);
+	}
+
+	update_level(model, model->root, roots);
+
+	g_ptr_array_free(roots, TRUE);
+}
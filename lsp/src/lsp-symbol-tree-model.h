@@ -0,0 +1,45 @@
+/*
+ * Copyright 2024 Jiri Techet <techet@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef LSP_SYMBOL_TREE_MODEL_H
+#define LSP_SYMBOL_TREE_MODEL_H 1
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+enum
+{
+	SYMBOLS_COLUMN_ICON,
+	SYMBOLS_COLUMN_NAME,
+	SYMBOLS_COLUMN_SYMBOL,
+	SYMBOLS_COLUMN_TOOLTIP,
+	SYMBOLS_N_COLUMNS
+};
+
+#define LSP_TYPE_SYMBOL_TREE_MODEL (lsp_symbol_tree_model_get_type())
+G_DECLARE_FINAL_TYPE(LspSymbolTreeModel, lsp_symbol_tree_model, LSP, SYMBOL_TREE_MODEL, GObject)
+
+LspSymbolTreeModel *lsp_symbol_tree_model_new(void);
+
+void lsp_symbol_tree_model_update(LspSymbolTreeModel *model, GPtrArray *symbols,
+	const gchar *filter, const gchar *encoding);
+
+G_END_DECLS
+
+#endif  /* LSP_SYMBOL_TREE_MODEL_H */
@@ -23,5 +23,6 @@ void lsp_symbol_tree_init(void);
 void lsp_symbol_tree_destroy(void);
 
 void lsp_symbol_tree_refresh(void);
+gboolean lsp_symbol_tree_is_visible(void);
 
 #endif  /* LSP_SYMBOL_TREE_H */
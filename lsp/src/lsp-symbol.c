@@ -21,34 +21,97 @@
 #endif
 
 #include "lsp-symbol.h"
+#include "lsp-utils.h"
+
+#include <string.h>
 
 
 typedef struct LspSymbol
 {
-	gchar *name;
-	gchar *detail;
-	gchar *scope;
-	gchar *file;
+	const gchar *name;    /* points to data */
+	const gchar *detail;  /* points to data */
+	const gchar *scope;   /* interned */
+	const gchar *file;    /* interned */
 	GeanyFiletypeID ft_id;
 	gulong line;
 	gulong pos;
 	glong kind;
 	guint icon;
+	gchar *search_key;  /* normalized and casefolded symbol tree name */
+
+	struct LspSymbol *parent;  /* weak, cleared when the parent is destroyed */
+	GPtrArray *children;       /* NULL when there are no children */
 
 	gint refcount; /* the reference count of the symbol */
+
+	gchar data[];  /* name and detail stored in the same allocation */
 } LspSymbol;
 
 
+/* Symbols coming from the same file (or the same scope) share the string
+ * instead of having their own copy. Maps strings to their reference count,
+ * only accessed from the main thread. */
+static GHashTable *interned_strings = NULL;
+
+
+static const gchar *string_intern(const gchar *str)
+{
+	gpointer key, value;
+
+	if (!str)
+		return NULL;
+
+	if (!interned_strings)
+		interned_strings = g_hash_table_new(g_str_hash, g_str_equal);
+
+	if (g_hash_table_lookup_extended(interned_strings, str, &key, &value))
+		g_hash_table_insert(interned_strings, key, GUINT_TO_POINTER(GPOINTER_TO_UINT(value) + 1));
+	else
+	{
+		key = g_strdup(str);
+		g_hash_table_insert(interned_strings, key, GUINT_TO_POINTER(1));
+	}
+
+	return key;
+}
+
+
+static void string_release(const gchar *str)
+{
+	gpointer key, value;
+
+	// symbols freed after lsp_symbol_cleanup()
+	if (!str || !interned_strings)
+		return;
+
+	if (!g_hash_table_lookup_extended(interned_strings, str, &key, &value))
+		g_return_if_reached();
+
+	if (GPOINTER_TO_UINT(value) > 1)
+		g_hash_table_insert(interned_strings, key, GUINT_TO_POINTER(GPOINTER_TO_UINT(value) - 1));
+	else
+	{
+		g_hash_table_remove(interned_strings, key);
+		g_free(key);
+	}
+}
+
+
 LspSymbol *lsp_symbol_new(const gchar *name, const gchar *detail, const gchar *scope, const gchar *file,
 	GeanyFiletypeID ft_id, glong kind, gulong line, gulong pos, guint icon)
 {
-	LspSymbol *sym = g_slice_new0(LspSymbol);
+	gsize name_len = name ? strlen(name) + 1 : 0;
+	gsize detail_len = detail ? strlen(detail) + 1 : 0;
+	LspSymbol *sym = g_malloc0(sizeof(LspSymbol) + name_len + detail_len);
+
 	sym->refcount = 1;
 
-	sym->name = g_strdup(name);
-	sym->detail = g_strdup(detail);
-	sym->scope = g_strdup(scope);
-	sym->file = g_strdup(file);
+	if (name)
+		sym->name = memcpy(sym->data, name, name_len);
+	if (detail)
+		sym->detail = memcpy(sym->data + name_len, detail, detail_len);
+	sym->scope = string_intern(scope);
+	sym->file = string_intern(file);
 	sym->ft_id = ft_id;
 	sym->kind = kind;
 	sym->line = line;
@@ -61,7 +124,7 @@ LspSymbol *lsp_symbol_new(const gchar *name, const gchar *detail, const gchar *s
 
 LspSymbol *lsp_symbol_new_from_tag(TMTag *tag)
 {
-	LspSymbol *sym = g_slice_new0(LspSymbol);
+	LspSymbol *sym = g_malloc0(sizeof(LspSymbol));
 	sym->refcount = 1;
 	return sym;
 }
@@ -69,10 +132,42 @@ LspSymbol *lsp_symbol_new_from_tag(TMTag *tag)
 
 static void symbol_destroy(LspSymbol *sym)
 {
-	g_free(sym->name);
-	g_free(sym->detail);
-	g_free(sym->scope);
-	g_free(sym->file);
+	if (sym->children)
+	{
+		LspSymbol *child;
+		guint i;
+
+		foreach_ptr_array(child, i, sym->children)
+		{
+			/* only children still referenced from outside the symbol tree
+			 * (cached arrays release children first) need their scope */
+			if (g_atomic_int_get(&child->refcount) > 1)
+				lsp_symbol_get_scope(child);
+			child->parent = NULL;
+		}
+		g_ptr_array_free(sym->children, TRUE);
+	}
+
+	string_release(sym->scope);
+	string_release(sym->file);
+	g_free(sym->search_key);
+}
+
+
+/* frees the interned strings on plugin unload, symbols should be freed before */
+void lsp_symbol_cleanup(void)
+{
+	GHashTableIter iter;
+	gpointer key;
+
+	if (!interned_strings)
+		return;
+
+	g_hash_table_iter_init(&iter, interned_strings);
+	while (g_hash_table_iter_next(&iter, &key, NULL))
+		g_free(key);
+	g_hash_table_destroy(interned_strings);
+	interned_strings = NULL;
 }
 
 
@@ -93,7 +188,7 @@ void lsp_symbol_unref(LspSymbol *sym)
 	if (sym && g_atomic_int_dec_and_test(&sym->refcount))
 	{
 		symbol_destroy(sym);
-		g_slice_free(LspSymbol, sym);
+		g_free(sym);
 	}
 }
 
@@ -105,6 +200,12 @@ LspSymbol *lsp_symbol_ref(LspSymbol *sym)
 }
 
 
+GeanyFiletypeID lsp_symbol_get_ft_id(const LspSymbol *sym)
+{
+	return sym->ft_id;
+}
+
+
 gulong lsp_symbol_get_line(const LspSymbol *sym)
 {
 	return sym->line;
@@ -117,12 +218,61 @@ gulong lsp_symbol_get_pos(const LspSymbol *sym)
 }
 
 
+/* for symbols with a parent the scope is computed from the parent chain
+ * on first access only */
 const gchar *lsp_symbol_get_scope(const LspSymbol *sym)
 {
+	if (!sym->scope && sym->parent)
+	{
+		LspSymbol *s = (LspSymbol *) sym;
+		gchar *scope = lsp_symbol_get_name_with_scope(sym->parent);
+
+		s->scope = string_intern(scope);
+		g_free(scope);
+	}
+
 	return sym->scope;
 }
 
 
+const gchar *lsp_symbol_get_search_key(const LspSymbol *sym)
+{
+	if (!sym->search_key)
+	{
+		LspSymbol *s = (LspSymbol *) sym;
+		gchar *tree_name = lsp_symbol_get_symtree_name(sym, FALSE);
+
+		s->search_key = lsp_utils_normalize_casefold(tree_name);
+		g_free(tree_name);
+	}
+
+	return sym->search_key;
+}
+
+
+LspSymbol *lsp_symbol_get_parent(const LspSymbol *sym)
+{
+	return sym->parent;
+}
+
+
+GPtrArray *lsp_symbol_get_children(const LspSymbol *sym)
+{
+	return sym->children;
+}
+
+
+void lsp_symbol_add_child(LspSymbol *parent, LspSymbol *child)
+{
+	g_return_if_fail(child->parent == NULL);
+
+	if (!parent->children)
+		parent->children = g_ptr_array_new_with_free_func((GDestroyNotify)lsp_symbol_unref);
+	g_ptr_array_add(parent->children, lsp_symbol_ref(child));
+	child->parent = parent;
+}
+
+
 const gchar *lsp_symbol_get_name(const LspSymbol *sym)
 {
 	return sym->name;
@@ -155,12 +305,13 @@ TMIcon lsp_symbol_get_icon(const LspSymbol *sym)
 
 gchar *lsp_symbol_get_name_with_scope(const LspSymbol *sym)
 {
+	const gchar *scope = lsp_symbol_get_scope(sym);
 	gchar *name = NULL;
 
-	if (EMPTY(sym->scope))
+	if (EMPTY(scope))
 		name = g_strdup(sym->name);
 	else
-		name = g_strconcat(sym->scope, LSP_SCOPE_SEPARATOR, sym->name, NULL);
+		name = g_strconcat(scope, LSP_SCOPE_SEPARATOR, sym->name, NULL);
 
 	return name;
 }
@@ -168,11 +319,12 @@ gchar *lsp_symbol_get_name_with_scope(const LspSymbol *sym)
 
 gchar *lsp_symbol_get_symtree_name(const LspSymbol *sym, gboolean include_scope)
 {
+	const gchar *scope = include_scope ? lsp_symbol_get_scope(sym) : NULL;
 	GString *buffer;
 
-	if (include_scope && !EMPTY(sym->scope))
+	if (!EMPTY(scope))
 	{
-		buffer = g_string_new(sym->scope);
+		buffer = g_string_new(scope);
 		g_string_append(buffer, LSP_SCOPE_SEPARATOR);
 		g_string_append(buffer, sym->name);
 	}
@@ -197,6 +349,8 @@ gboolean lsp_symbol_equal(const LspSymbol *a, const LspSymbol *b)
 		a->kind == b->kind && a->ft_id == b->ft_id &&
 		g_strcmp0(a->name, b->name) == 0 &&
 		g_strcmp0(a->file, b->file) == 0 &&
-		g_strcmp0(a->scope, b->scope) == 0 &&
+		/* the position in the hierarchy is compared by callers for symbols
+		 * with parents, their scope may not be computed yet */
+		((a->parent && b->parent) || g_strcmp0(a->scope, b->scope) == 0) &&
 		g_strcmp0(a->detail, b->detail) == 0;
 }
@@ -39,6 +39,7 @@ LspSymbol *lsp_symbol_ref(LspSymbol *sym);
 LspSymbol *lsp_symbol_new(const gchar *name, const gchar *detail, const gchar *scope, const gchar *file,
 	GeanyFiletypeID ft_id, glong kind, gulong line, gulong pos, guint icon);
 
+GeanyFiletypeID lsp_symbol_get_ft_id(const LspSymbol *sym);
 gulong lsp_symbol_get_line(const LspSymbol *sym);
 gulong lsp_symbol_get_pos(const LspSymbol *sym);
 glong lsp_symbol_get_kind(const LspSymbol *sym);
@@ -47,6 +48,11 @@ const gchar *lsp_symbol_get_scope(const LspSymbol *sym);
 const gchar *lsp_symbol_get_name(const LspSymbol *sym);
 const gchar *lsp_symbol_get_file(const LspSymbol *sym);
 const gchar *lsp_symbol_get_detail(const LspSymbol *sym);
+const gchar *lsp_symbol_get_search_key(const LspSymbol *sym);
+
+LspSymbol *lsp_symbol_get_parent(const LspSymbol *sym);
+GPtrArray *lsp_symbol_get_children(const LspSymbol *sym);
+void lsp_symbol_add_child(LspSymbol *parent, LspSymbol *child);
 
 gchar *lsp_symbol_get_name_with_scope(const LspSymbol *sym);
 
@@ -55,6 +61,8 @@ gchar *lsp_symbol_get_symtree_tooltip(const LspSymbol *sym, const gchar *encodin
 
 gboolean lsp_symbol_equal(const LspSymbol *a, const LspSymbol *b);
 
+void lsp_symbol_cleanup(void);
+
 G_END_DECLS
 
 #endif  /* LSP_SYMBOL_H */
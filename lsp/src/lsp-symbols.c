@@ -26,13 +26,16 @@
 #include "lsp-sync.h"
 #include "lsp-symbol-kinds.h"
 #include "lsp-symbol.h"
+#include "lsp-symbol-index.h"
 
 #include <jsonrpc-glib.h>
 
 #define CACHED_SYMBOLS_KEY "lsp_symbols_cached"
+#define CACHED_VERSION_KEY "lsp_symbols_cached_version"
 
 typedef struct {
 	GeanyDocument *doc;
+	guint version;
 	LspCallback callback;
 	gpointer user_data;
 } LspSymbolUserData;
@@ -48,10 +51,19 @@ extern GeanyPlugin *geany_plugin;
 extern GeanyData *geany_data;
 
 
+/* symbols are stored in pre-order - release them from the end so children
+ * go away before their parents and nothing has to remember their scope */
 static void arr_free(GPtrArray *arr)
 {
-	if (arr)
-		g_ptr_array_free(arr, TRUE);
+	guint i;
+
+	if (!arr)
+		return;
+
+	g_ptr_array_set_free_func(arr, NULL);
+	for (i = arr->len; i > 0; i--)
+		lsp_symbol_unref(arr->pdata[i - 1]);
+	g_ptr_array_free(arr, TRUE);
 }
 
 
@@ -59,13 +71,15 @@ void lsp_symbols_destroy(GeanyDocument *doc)
 {
 	plugin_set_document_data_full(geany_plugin, doc, CACHED_SYMBOLS_KEY,
 			NULL, (GDestroyNotify)arr_free);
+	plugin_set_document_data(geany_plugin, doc, CACHED_VERSION_KEY, GUINT_TO_POINTER(0));
 }
 
 
-static void parse_symbols(GPtrArray *symbols, GVariant *symbol_variant, const gchar *scope,
-	const gchar *scope_sep, gboolean workspace)
+/* symbols are added to the flat symbols array in pre-order, hierarchical
+ * DocumentSymbol children are also linked to their parent */
+static void parse_symbols(GPtrArray *symbols, GVariant *symbol_variant, LspSymbol *parent,
+	const gchar *doc_file_name, GeanyFiletypeID ft_id, gboolean workspace)
 {
-	GeanyDocument *doc = document_get_current();
 	GVariant *member = NULL;
 	GVariantIter iter;
 
@@ -144,32 +158,26 @@ static void parse_symbols(GPtrArray *symbols, GVariant *symbol_variant, const gc
 
 		JSONRPC_MESSAGE_PARSE(member, "detail", JSONRPC_MESSAGE_GET_STRING(&detail));
 
-		if (scope)
-			sym_scope = scope;
-		else if (container_name)
+		if (!parent && container_name)
 			sym_scope = container_name;
 
 		if (uri_str)
 			file_name = lsp_utils_get_real_path_from_uri_utf8(uri_str);
-		else if (doc && doc->real_path)
-			file_name = utils_get_utf8_from_locale(doc->real_path);
+		else
+			file_name = g_strdup(doc_file_name);
 
-		sym = lsp_symbol_new(name, detail, sym_scope, file_name, doc->file_type->id, kind,
+		sym = lsp_symbol_new(name, detail, sym_scope, file_name, ft_id, kind,
 			line_num + 1, line_pos, lsp_symbol_kinds_get_symbol_icon(kind));
 
 		g_ptr_array_add(symbols, sym);
+		if (parent)
+			lsp_symbol_add_child(parent, sym);
+		/* precompute the key used by the symbol tree filter */
+		if (!workspace)
+			lsp_symbol_get_search_key(sym);
 
 		if (JSONRPC_MESSAGE_PARSE(member, "children", JSONRPC_MESSAGE_GET_VARIANT(&children)))
-		{
-			gchar *new_scope;
-
-			if (scope)
-				new_scope = g_strconcat(scope, scope_sep, lsp_symbol_get_name(sym), NULL);
-			else
-				new_scope = g_strdup(lsp_symbol_get_name(sym));
-			parse_symbols(symbols, children, new_scope, scope_sep, FALSE);
-			g_free(new_scope);
-		}
+			parse_symbols(symbols, children, sym, doc_file_name, ft_id, FALSE);
 
 		if (loc_variant)
 			g_variant_unref(loc_variant);
@@ -189,18 +197,35 @@ static void symbols_cb(GVariant *return_value, GError *error, gpointer user_data
 	{
 		//printf("%s\n\n\n", lsp_utils_json_pretty_print(return_value));
 
-		if (data->doc == document_get_current())
+		if (DOC_VALID(data->doc) && data->doc->real_path)
 		{
 			GPtrArray *cached_symbols = g_ptr_array_new_full(0, (GDestroyNotify)lsp_symbol_unref);
+			gchar *file_name = utils_get_utf8_from_locale(data->doc->real_path);
+
+			parse_symbols(cached_symbols, return_value, NULL, file_name,
+				data->doc->file_type->id, FALSE);
+
+			// the index describes files on disk, symbols of the saved
+			// document are indexed when fetched first after the save
+			if (!data->doc->changed && data->version == lsp_sync_get_doc_version(data->doc))
+				lsp_symbol_index_update_file(file_name, cached_symbols);
 
-			parse_symbols(cached_symbols, return_value, NULL, LSP_SCOPE_SEPARATOR, FALSE);
+			if (data->doc == document_get_current())
+			{
+				plugin_set_document_data_full(geany_plugin, data->doc, CACHED_SYMBOLS_KEY,
+					cached_symbols, (GDestroyNotify)arr_free);
+				plugin_set_document_data(geany_plugin, data->doc, CACHED_VERSION_KEY,
+					GUINT_TO_POINTER(data->version));
+			}
+			else
+				arr_free(cached_symbols);
 
-			plugin_set_document_data_full(geany_plugin, data->doc, CACHED_SYMBOLS_KEY,
-				cached_symbols, (GDestroyNotify)arr_free);
+			g_free(file_name);
 		}
 	}
 
-	data->callback(data->user_data);
+	if (data->callback)
+		data->callback(data->user_data);
 
 	g_free(user_data);
 }
@@ -215,6 +240,20 @@ GPtrArray *lsp_symbols_doc_get_cached(GeanyDocument *doc)
 }
 
 
+/* TRUE when the cached symbols correspond to the current document version
+ * so there's no need to ask the server again */
+gboolean lsp_symbols_doc_cache_valid(GeanyDocument *doc)
+{
+	guint version;
+
+	if (!lsp_symbols_doc_get_cached(doc))
+		return FALSE;
+
+	version = GPOINTER_TO_UINT(plugin_get_document_data(geany_plugin, doc, CACHED_VERSION_KEY));
+	return version != 0 && version == lsp_sync_get_doc_version(doc);
+}
+
+
 void lsp_symbols_doc_request(GeanyDocument *doc, LspCallback callback,
 	gpointer user_data)
 {
@@ -236,6 +275,7 @@ void lsp_symbols_doc_request(GeanyDocument *doc, LspCallback callback,
 	/* Geany requests symbols before firing "document-activate" signal so we may
 	 * need to request document opening here */
 	lsp_sync_text_document_did_open(server, doc);
+	data->version = lsp_sync_get_doc_version(doc);
 
 	node = JSONRPC_MESSAGE_NEW (
 		"textDocument", "{",
@@ -256,25 +296,33 @@ void lsp_symbols_doc_request(GeanyDocument *doc, LspCallback callback,
 static void workspace_symbols_cb(GVariant *return_value, GError *error, gpointer user_data)
 {
 	LspWorkspaceSymbolUserData *data = user_data;
-	GPtrArray *ret = g_ptr_array_new_full(0, (GDestroyNotify)lsp_symbol_unref);
+	GPtrArray *ret = NULL;
 
-	if (!error && g_variant_is_of_type(return_value, G_VARIANT_TYPE_ARRAY))
+	// cancelled or failed requests are reported by passing NULL
+	if (!error)
 	{
-		//printf("%s\n\n\n", lsp_utils_json_pretty_print(return_value));
+		ret = g_ptr_array_new_full(0, (GDestroyNotify)lsp_symbol_unref);
+
+		if (g_variant_is_of_type(return_value, G_VARIANT_TYPE_ARRAY))
+		{
+			//printf("%s\n\n\n", lsp_utils_json_pretty_print(return_value));
+
+			parse_symbols(ret, return_value, NULL, NULL, data->ft_id, TRUE);
 
-		//scope separator doesn't matter here
-		parse_symbols(ret, return_value, NULL, "", TRUE);
+			lsp_symbol_index_add(ret);
+		}
 	}
 
 	data->callback(ret, data->user_data);
 
-	g_ptr_array_free(ret, TRUE);
+	if (ret)
+		g_ptr_array_free(ret, TRUE);
 	g_free(user_data);
 }
 
 
 void lsp_symbols_workspace_request(GeanyDocument *doc, const gchar *query,
-	LspWorkspaceSymbolRequestCallback callback, gpointer user_data)
+	GCancellable *cancellable, LspWorkspaceSymbolRequestCallback callback, gpointer user_data)
 {
 	LspServer *server = lsp_server_get(doc);
 	LspWorkspaceSymbolUserData *data;
@@ -294,7 +342,7 @@ void lsp_symbols_workspace_request(GeanyDocument *doc, const gchar *query,
 
 	//printf("%s\n\n\n", lsp_utils_json_pretty_print(node));
 
-	lsp_rpc_call(server, "workspace/symbol", node,
+	lsp_rpc_call_cancellable(server, "workspace/symbol", node, cancellable,
 		workspace_symbols_cb, data);
 
 	g_variant_unref(node);
@@ -22,17 +22,20 @@
 #include "lsp-server.h"
 
 #include <glib.h>
+#include <gio/gio.h>
 
 void lsp_symbols_doc_request(GeanyDocument *doc, LspCallback callback,
 	gpointer user_data);
 
 GPtrArray *lsp_symbols_doc_get_cached(GeanyDocument *doc);
+gboolean lsp_symbols_doc_cache_valid(GeanyDocument *doc);
 
 
+/* arr is NULL when the request failed or was cancelled */
 typedef void (*LspWorkspaceSymbolRequestCallback) (GPtrArray *arr, gpointer user_data);
 
-void lsp_symbols_workspace_request(GeanyDocument *doc, const gchar *query, LspWorkspaceSymbolRequestCallback callback,
-	gpointer user_data);
+void lsp_symbols_workspace_request(GeanyDocument *doc, const gchar *query, GCancellable *cancellable,
+	LspWorkspaceSymbolRequestCallback callback, gpointer user_data);
 
 void lsp_symbols_destroy(GeanyDocument *doc);
 
@@ -28,25 +28,42 @@
 #include "lsp-semtokens.h"
 #include "lsp-workspace-folders.h"
 #include "lsp-symbols.h"
+#include "lsp-text-edit.h"
 
 #include <jsonrpc-glib.h>
 
 #define VERSION_NUM_KEY "lsp_sync_version_num"
 
-#define MRU_SIZE 50
+// the lowest limit of open documents when reduced because of memory usage
+#define MIN_OPEN_DOCS 5
+
+// edits closer to each other than this are applied as a single span
+#define MERGE_GAP 64
+
+
+typedef struct
+{
+	gint start;  // Scintilla positions in the original document
+	gint end;
+	GString *text;
+} EditSpan;
 
 
 extern GeanyPlugin *geany_plugin;
 
+static GeanyDocument *suppressed_doc = NULL;
+
 
 void lsp_sync_init(LspServer *srv)
 {
+	/* doc -> its GList link in mru_docs */
 	if (!srv->open_docs)
 		srv->open_docs = g_hash_table_new(NULL, NULL);
 	g_hash_table_remove_all(srv->open_docs);
 
-	g_slist_free(srv->mru_docs);
-	srv->mru_docs = NULL;
+	g_queue_clear(&srv->mru_docs);
+
+	srv->open_docs_limit = MAX(srv->config.max_open_documents, 0);
 }
 
 
@@ -54,7 +71,6 @@ static void destroy_doc_data(LspServer *srv, GeanyDocument *doc)
 {
 	lsp_semtokens_destroy(doc);
 	lsp_symbols_destroy(doc);
-	srv->mru_docs = g_slist_remove(srv->mru_docs, doc);
 }
 
 
@@ -74,12 +90,20 @@ void lsp_sync_free(LspServer *srv)
 		g_hash_table_destroy(srv->open_docs);
 	}
 	srv->open_docs = NULL;
+
+	g_queue_clear(&srv->mru_docs);
+}
+
+
+guint lsp_sync_get_doc_version(GeanyDocument *doc)
+{
+	return GPOINTER_TO_UINT(plugin_get_document_data(geany_plugin, doc, VERSION_NUM_KEY));
 }
 
 
 static guint get_next_doc_version_num(GeanyDocument *doc)
 {
-	guint num = GPOINTER_TO_UINT(plugin_get_document_data(geany_plugin, doc, VERSION_NUM_KEY));
+	guint num = lsp_sync_get_doc_version(doc);
 
 	num++;
 	plugin_set_document_data(geany_plugin, doc, VERSION_NUM_KEY, GUINT_TO_POINTER(num));
@@ -96,6 +120,41 @@ gboolean lsp_sync_is_document_open(LspServer *server, GeanyDocument *doc)
 }
 
 
+/* closes the least recently used documents above the limit, documents which
+ * are visible or modified are never closed */
+static void evict_docs(LspServer *server, guint limit)
+{
+	GeanyDocument *current_doc = document_get_current();
+	GList *link = server->mru_docs.head;
+
+	while (link && server->mru_docs.length > limit)
+	{
+		GeanyDocument *doc = link->data;
+
+		link = link->next;
+		if (doc != current_doc && !doc->changed)
+			lsp_sync_text_document_did_close(server, doc);
+	}
+}
+
+
+/* sets the maximum number of open documents, lowered when the server uses
+ * too much memory; never above max_open_documents, 0 means no limit */
+void lsp_sync_set_open_docs_limit(LspServer *server, guint limit)
+{
+	guint max_limit = MAX(server->config.max_open_documents, 0);
+
+	if (max_limit == 0)
+	{
+		server->open_docs_limit = 0;
+		return;
+	}
+
+	server->open_docs_limit = CLAMP(limit, MIN(MIN_OPEN_DOCS, max_limit), max_limit);
+	evict_docs(server, server->open_docs_limit);
+}
+
+
 void lsp_sync_text_document_did_open(LspServer *server, GeanyDocument *doc)
 {
 	GVariant *node;
@@ -103,19 +162,28 @@ void lsp_sync_text_document_did_open(LspServer *server, GeanyDocument *doc)
 	gchar *lang_id = NULL;
 	gchar *doc_text;
 	guint doc_version;
+	GList *link;
 
-	if (!server || lsp_sync_is_document_open(server, doc))
+	if (!server)
 		return;
 
-	if (g_slist_length(server->mru_docs) >= MRU_SIZE)
+	link = g_hash_table_lookup(server->open_docs, doc);
+	if (link)
 	{
-		lsp_sync_text_document_did_close(server, server->mru_docs->data);
+		// most recently used
+		g_queue_unlink(&server->mru_docs, link);
+		g_queue_push_tail_link(&server->mru_docs, link);
+		return;
 	}
 
+	// one more for the new document
+	if (server->open_docs_limit > 0)
+		evict_docs(server, server->open_docs_limit - 1);
+
 	lsp_workspace_folders_doc_open(doc);
 
-	g_hash_table_add(server->open_docs, doc);
-	server->mru_docs = g_slist_append(server->mru_docs, doc);
+	g_queue_push_tail(&server->mru_docs, doc);
+	g_hash_table_insert(server->open_docs, doc, server->mru_docs.tail);
 
 	lsp_server_get_ft(doc, &lang_id);
 	doc_uri = lsp_utils_get_doc_uri(doc);
@@ -164,6 +232,7 @@ void lsp_sync_text_document_did_close(LspServer *server, GeanyDocument *doc)
 
 	//printf("%s\n\n\n", lsp_utils_json_pretty_print(node));
 
+	g_queue_delete_link(&server->mru_docs, g_hash_table_lookup(server->open_docs, doc));
 	g_hash_table_remove(server->open_docs, doc);
 
 	lsp_rpc_notify(server, "textDocument/didClose", node, NULL, NULL);
@@ -272,3 +341,210 @@ void lsp_sync_text_document_did_change(LspServer *server, GeanyDocument *doc,
 
 	g_variant_unref(node);
 }
+
+
+gboolean lsp_sync_did_change_suppressed(GeanyDocument *doc)
+{
+	return doc == suppressed_doc;
+}
+
+
+static GVariant *new_change(ScintillaObject *sci, EditSpan *span)
+{
+	LspPosition pos_start = lsp_utils_scintilla_pos_to_lsp(sci, span->start);
+	LspPosition pos_end = lsp_utils_scintilla_pos_to_lsp(sci, span->end);
+	gint range = SSM(sci, SCI_COUNTCODEUNITS, span->start, span->end);
+
+	return JSONRPC_MESSAGE_NEW (
+		"range", "{",
+			"start", "{",
+				"line", JSONRPC_MESSAGE_PUT_INT32(pos_start.line),
+				"character", JSONRPC_MESSAGE_PUT_INT32(pos_start.character),
+			"}",
+			"end", "{",
+				"line", JSONRPC_MESSAGE_PUT_INT32(pos_end.line),
+				"character", JSONRPC_MESSAGE_PUT_INT32(pos_end.character),
+			"}",
+		"}",
+		"rangeLength", JSONRPC_MESSAGE_PUT_INT32(range),
+		"text", JSONRPC_MESSAGE_PUT_STRING(span->text->str)
+	);
+}
+
+
+static void notify_did_change(LspServer *server, GeanyDocument *doc, GPtrArray *changes)
+{
+	gchar *doc_uri = lsp_utils_get_doc_uri(doc);
+	guint doc_version = get_next_doc_version_num(doc);
+	GVariant *text_document;
+	GVariant *node;
+	GVariantDict dict;
+
+	text_document = JSONRPC_MESSAGE_NEW (
+		"uri", JSONRPC_MESSAGE_PUT_STRING(doc_uri),
+		"version", JSONRPC_MESSAGE_PUT_INT32(doc_version)
+	);
+
+	g_variant_dict_init(&dict, NULL);
+	g_variant_dict_insert_value(&dict, "textDocument", text_document);
+	g_variant_dict_insert_value(&dict, "contentChanges", g_variant_new_array(G_VARIANT_TYPE_VARDICT,
+		(GVariant **)changes->pdata, changes->len));
+	node = g_variant_take_ref(g_variant_dict_end(&dict));
+
+	//printf("%s\n\n\n", lsp_utils_json_pretty_print(node));
+
+	lsp_rpc_notify(server, "textDocument/didChange", node, NULL, NULL);
+
+	g_free(doc_uri);
+	g_variant_unref(text_document);
+	g_variant_unref(node);
+}
+
+
+static gboolean is_continuation_byte(const gchar *str, gsize i)
+{
+	return ((guchar)str[i] & 0xC0) == 0x80;
+}
+
+
+/* removes the parts of the span which are the same in the original text */
+static void trim_span(ScintillaObject *sci, EditSpan *span)
+{
+	gchar *orig = sci_get_contents_range(sci, span->start, span->end);
+	const gchar *text = span->text->str;
+	gsize orig_len = span->end - span->start;
+	gsize text_len = span->text->len;
+	gsize prefix = 0;
+	gsize suffix = 0;
+
+	while (prefix < orig_len && prefix < text_len && orig[prefix] == text[prefix])
+		prefix++;
+	// don't split multi-byte characters and CRLF
+	while (prefix > 0 && (is_continuation_byte(orig, prefix) || is_continuation_byte(text, prefix)))
+		prefix--;
+	if (prefix > 0 && orig[prefix - 1] == '\r' && orig[prefix] == '\n')
+		prefix--;
+
+	while (suffix < orig_len - prefix && suffix < text_len - prefix &&
+		orig[orig_len - suffix - 1] == text[text_len - suffix - 1])
+	{
+		suffix++;
+	}
+	while (suffix > 0 && is_continuation_byte(orig, orig_len - suffix))
+		suffix--;
+	if (suffix > 0 && orig_len - suffix > 0 && orig[orig_len - suffix] == '\n' &&
+		orig[orig_len - suffix - 1] == '\r')
+	{
+		suffix--;
+	}
+
+	span->start += prefix;
+	span->end -= suffix;
+	g_string_truncate(span->text, text_len - suffix);
+	g_string_erase(span->text, 0, prefix);
+
+	g_free(orig);
+}
+
+
+/* Applies edits like formatting results which may consist of thousands of
+ * small edits. Nearby edits are merged into spans, unchanged parts of the spans
+ * are trimmed and the spans are applied without sending didChange for every
+ * Scintilla modification - all the changes are sent in a single didChange at
+ * the end. */
+void lsp_sync_apply_text_edits(LspServer *server, GeanyDocument *doc, GPtrArray *edits)
+{
+	ScintillaObject *sci = doc->editor->sci;
+	GPtrArray *changes;
+	GPtrArray *arr;
+	GArray *spans;
+	LspTextEdit *e;
+	gboolean modified = FALSE;
+	guint i;
+
+	if (!edits || edits->len == 0)
+		return;
+
+	// make sure the server has the original document before we start suppressing changes
+	lsp_sync_text_document_did_open(server, doc);
+
+	arr = g_ptr_array_new_full(edits->len, NULL);
+	foreach_ptr_array(e, i, edits)
+		g_ptr_array_add(arr, e);
+	// stable so inserts at the same position keep their order
+	g_ptr_array_sort(arr, lsp_text_edit_cmp);
+
+	spans = g_array_new(FALSE, FALSE, sizeof(EditSpan));
+	foreach_ptr_array(e, i, arr)
+	{
+		EditSpan *last = spans->len > 0 ? &g_array_index(spans, EditSpan, spans->len - 1) : NULL;
+		gint start = lsp_utils_lsp_pos_to_scintilla(sci, e->range.start);
+		gint end = lsp_utils_lsp_pos_to_scintilla(sci, e->range.end);
+
+		// edits shouldn't overlap but let's not crash when they do
+		if (last)
+			start = MAX(start, last->end);
+		end = MAX(end, start);
+
+		if (last && start - last->end <= MERGE_GAP)
+		{
+			gchar *gap = sci_get_contents_range(sci, last->end, start);
+
+			g_string_append(last->text, gap);
+			g_string_append(last->text, e->new_text);
+			last->end = end;
+			g_free(gap);
+		}
+		else
+		{
+			EditSpan span = {start, end, g_string_new(e->new_text)};
+			g_array_append_val(spans, span);
+		}
+	}
+
+	changes = g_ptr_array_new_full(spans->len, (GDestroyNotify)g_variant_unref);
+
+	suppressed_doc = doc;
+	sci_start_undo_action(sci);
+
+	// from the end so positions of the remaining spans stay valid
+	for (i = spans->len; i > 0; i--)
+	{
+		EditSpan *span = &g_array_index(spans, EditSpan, i - 1);
+
+		trim_span(sci, span);
+		if (span->start == span->end && span->text->len == 0)
+			continue;
+
+		if (server && server->use_incremental_sync)
+			g_ptr_array_add(changes, new_change(sci, span));
+
+		SSM(sci, SCI_SETTARGETRANGE, span->start, span->end);
+		SSM(sci, SCI_REPLACETARGET, span->text->len, (sptr_t) span->text->str);
+		modified = TRUE;
+	}
+
+	sci_end_undo_action(sci);
+	suppressed_doc = NULL;
+
+	if (server && modified && lsp_sync_is_document_open(server, doc))
+	{
+		if (!server->use_incremental_sync)
+		{
+			gchar *text = sci_get_contents(sci, -1);
+
+			g_ptr_array_add(changes, JSONRPC_MESSAGE_NEW (
+				"text", JSONRPC_MESSAGE_PUT_STRING(text)
+			));
+			g_free(text);
+		}
+
+		notify_did_change(server, doc, changes);
+	}
+
+	for (i = 0; i < spans->len; i++)
+		g_string_free(g_array_index(spans, EditSpan, i).text, TRUE);
+	g_array_free(spans, TRUE);
+	g_ptr_array_free(changes, TRUE);
+	g_ptr_array_free(arr, TRUE);
+}
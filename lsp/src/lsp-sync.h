@@ -26,12 +26,18 @@
 void lsp_sync_init(LspServer *server);
 void lsp_sync_free(LspServer *server);
 
+void lsp_sync_set_open_docs_limit(LspServer *server, guint limit);
+
 void lsp_sync_text_document_did_open(LspServer *server, GeanyDocument *doc);
 void lsp_sync_text_document_did_close(LspServer *server, GeanyDocument *doc);
 void lsp_sync_text_document_did_save(LspServer *server, GeanyDocument *doc);
 void lsp_sync_text_document_did_change(LspServer *server, GeanyDocument *doc,
 	LspPosition pos_start, LspPosition pos_end, gchar *text);
 
+void lsp_sync_apply_text_edits(LspServer *server, GeanyDocument *doc, GPtrArray *edits);
+gboolean lsp_sync_did_change_suppressed(GeanyDocument *doc);
+
 gboolean lsp_sync_is_document_open(LspServer *server, GeanyDocument *doc);
+guint lsp_sync_get_doc_version(GeanyDocument *doc);
 
 #endif  /* LSP_SYNC_H */
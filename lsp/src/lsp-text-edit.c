@@ -0,0 +1,229 @@
+/*
+ * Copyright 2024 Jiri Techet <techet@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/* Applies text edits to files which aren't open in Geany directly on their
+ * contents, without loading them into Scintilla. */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "lsp-text-edit.h"
+#include "lsp-utils.h"
+
+#include <geanyplugin.h>
+
+#include <gio/gio.h>
+#include <string.h>
+
+
+#define MAX_EDIT_THREADS 8
+
+
+typedef struct
+{
+	const gchar *buf;
+	gsize len;
+	gsize line_start;  // offset of the start of line
+	gint64 line;
+} PosScanner;
+
+
+/* Converts LSP position (with UTF-16 character offset) into a byte offset in
+ * the UTF-8 buffer. Lines are only searched forward from the last position
+ * so converting sorted positions takes a single pass over the buffer. */
+static gsize position_to_offset(PosScanner *sc, LspPosition pos)
+{
+	gint64 units = 0;
+	gsize offset;
+
+	if (pos.line < sc->line)
+	{
+		sc->line = 0;
+		sc->line_start = 0;
+	}
+
+	while (sc->line < pos.line)
+	{
+		gsize line_len = lsp_utils_skip_line(sc->buf + sc->line_start, sc->len - sc->line_start);
+
+		if (line_len == 0)
+			return sc->len;
+
+		sc->line_start += line_len;
+		sc->line++;
+	}
+
+	offset = sc->line_start;
+	while (units < pos.character && offset < sc->len)
+	{
+		guchar c = sc->buf[offset];
+		gsize char_len;
+
+		if (c == '\n' || c == '\r')
+			break;
+
+		if (c < 0xC0)
+			char_len = 1;  // ASCII or invalid
+		else if (c < 0xE0)
+			char_len = 2;
+		else if (c < 0xF0)
+			char_len = 3;
+		else
+			char_len = 4;
+
+		// characters outside BMP take 2 UTF-16 code units
+		units += char_len == 4 ? 2 : 1;
+		offset = MIN(offset + char_len, sc->len);
+	}
+
+	return offset;
+}
+
+
+/* GPtrArray comparator ordering LspTextEdit* by start position */
+gint lsp_text_edit_cmp(gconstpointer a, gconstpointer b)
+{
+	LspTextEdit *e1 = *((LspTextEdit **)a);
+	LspTextEdit *e2 = *((LspTextEdit **)b);
+
+	if (e1->range.start.line != e2->range.start.line)
+		return e1->range.start.line < e2->range.start.line ? -1 : 1;
+	if (e1->range.start.character != e2->range.start.character)
+		return e1->range.start.character < e2->range.start.character ? -1 : 1;
+	return 0;
+}
+
+
+/* Returns @contents with @edits applied. Edits are non-overlapping ranges
+ * against the original contents so they are applied in one pass from the
+ * start; edits inserting at the same position keep their order. */
+gchar *lsp_text_edit_apply(const gchar *contents, gsize len, GPtrArray *edits, gsize *new_len)
+{
+	PosScanner sc = {contents, len, 0, 0};
+	GPtrArray *arr = g_ptr_array_new_full(edits->len, NULL);
+	GString *out = g_string_sized_new(len + len / 8 + 1);
+	gsize copied = 0;
+	LspTextEdit *e;
+	guint i;
+
+	foreach_ptr_array(e, i, edits)
+		g_ptr_array_add(arr, e);
+	g_ptr_array_sort(arr, lsp_text_edit_cmp);  // stable
+
+	foreach_ptr_array(e, i, arr)
+	{
+		gsize start = position_to_offset(&sc, e->range.start);
+		gsize end = position_to_offset(&sc, e->range.end);
+
+		start = MAX(start, copied);
+		end = MAX(end, start);
+
+		g_string_append_len(out, contents + copied, start - copied);
+		if (e->new_text)
+			g_string_append(out, e->new_text);
+		copied = end;
+	}
+	g_string_append_len(out, contents + copied, len - copied);
+
+	g_ptr_array_free(arr, TRUE);
+
+	*new_len = out->len;
+	return g_string_free(out, FALSE);
+}
+
+
+LspFileEdits *lsp_text_edit_file_edits_new(const gchar *fname, const gchar *locale_fname)
+{
+	LspFileEdits *file_edits = g_new0(LspFileEdits, 1);
+
+	file_edits->fname = g_strdup(fname);
+	file_edits->locale_fname = g_strdup(locale_fname);
+	file_edits->edits = g_ptr_array_new_full(1, (GDestroyNotify)g_ptr_array_unref);
+
+	return file_edits;
+}
+
+
+void lsp_text_edit_file_edits_free(LspFileEdits *file_edits)
+{
+	g_ptr_array_free(file_edits->edits, TRUE);
+	if (file_edits->error)
+		g_error_free(file_edits->error);
+	g_free(file_edits->locale_fname);
+	g_free(file_edits->fname);
+	g_free(file_edits);
+}
+
+
+static void apply_to_file(gpointer data, gpointer user_data)
+{
+	LspFileEdits *file_edits = data;
+	GFile *file = g_file_new_for_path(file_edits->locale_fname);
+	gchar *contents;
+	GPtrArray *edits;
+	gsize len;
+	guint i;
+
+	if (g_file_load_contents(file, NULL, &contents, &len, NULL, &file_edits->error))
+	{
+		foreach_ptr_array(edits, i, file_edits->edits)
+		{
+			gchar *new_contents = lsp_text_edit_apply(contents, len, edits, &len);
+
+			g_free(contents);
+			contents = new_contents;
+		}
+
+		/* written to a temporary file and renamed over the original,
+		 * keeping its permissions */
+		g_file_replace_contents(file, contents, len, NULL, FALSE, G_FILE_CREATE_NONE,
+			NULL, NULL, &file_edits->error);
+
+		g_free(contents);
+	}
+
+	g_object_unref(file);
+}
+
+
+/* applies the edits to the files in parallel and waits until all of them
+ * are written, errors are stored into the LspFileEdits */
+void lsp_text_edit_apply_to_files(GPtrArray *file_edits)
+{
+	GThreadPool *pool;
+	LspFileEdits *fe;
+	guint i;
+
+	if (file_edits->len == 0)
+		return;
+
+	if (file_edits->len == 1)
+	{
+		apply_to_file(file_edits->pdata[0], NULL);
+		return;
+	}
+
+	pool = g_thread_pool_new(apply_to_file, NULL,
+		MIN(g_get_num_processors(), MAX_EDIT_THREADS), FALSE, NULL);
+
+	foreach_ptr_array(fe, i, file_edits)
+		g_thread_pool_push(pool, fe, NULL);
+
+	g_thread_pool_free(pool, FALSE, TRUE);
+}
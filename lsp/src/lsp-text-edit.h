@@ -0,0 +1,43 @@
+/*
+ * Copyright 2024 Jiri Techet <techet@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef LSP_TEXT_EDIT_H
+#define LSP_TEXT_EDIT_H 1
+
+#include <glib.h>
+
+
+typedef struct
+{
+	gchar *fname;         // utf8
+	gchar *locale_fname;
+	GPtrArray *edits;     // GPtrArray of LspTextEdit arrays, applied one after another
+	GError *error;
+} LspFileEdits;
+
+
+gint lsp_text_edit_cmp(gconstpointer a, gconstpointer b);
+
+gchar *lsp_text_edit_apply(const gchar *contents, gsize len, GPtrArray *edits, gsize *new_len);
+
+LspFileEdits *lsp_text_edit_file_edits_new(const gchar *fname, const gchar *locale_fname);
+void lsp_text_edit_file_edits_free(LspFileEdits *file_edits);
+
+void lsp_text_edit_apply_to_files(GPtrArray *file_edits);
+
+#endif  /* LSP_TEXT_EDIT_H */
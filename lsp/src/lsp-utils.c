@@ -22,10 +22,13 @@
 
 #include "lsp-utils.h"
 #include "lsp-server.h"
+#include "lsp-text-edit.h"
+#include "lsp-sync.h"
 
 #include <geanyplugin.h>
 #include <jsonrpc-glib.h>
 #include <ctype.h>
+#include <glib/gstdio.h>
 
 
 extern GeanyData *geany_data;
@@ -480,7 +483,10 @@ void lsp_utils_apply_text_edits(ScintillaObject *sci, LspTextEdit *edit, GPtrArr
 }
 
 
-static void apply_edits_in_file(const gchar *uri, GPtrArray *edits)
+/* edits of open documents are applied right away, the rest is collected
+ * into @file_table and written to the files later; takes ownership of @edits */
+static void add_edits_in_file(const gchar *uri, GPtrArray *edits, GPtrArray *file_edits,
+	GHashTable *file_table)
 {
 	gchar *fname = lsp_utils_get_real_path_from_uri_utf8(uri);
 	gchar *fname_locale = lsp_utils_get_real_path_from_uri_locale(uri);
@@ -488,97 +494,367 @@ static void apply_edits_in_file(const gchar *uri, GPtrArray *edits)
 	if (fname && fname_locale)
 	{
 		GeanyDocument *doc = document_find_by_filename(fname);
-		ScintillaObject *sci = NULL;
 
 		if (doc)
-			sci = doc->editor->sci;
+		{
+			ScintillaObject *sci = doc->editor->sci;
+
+			sci_start_undo_action(sci);
+			lsp_utils_apply_text_edits(sci, NULL, edits, FALSE);
+			sci_end_undo_action(sci);
+			g_ptr_array_free(edits, TRUE);
+		}
 		else
-			sci = lsp_utils_new_sci_from_file(fname);
+		{
+			LspFileEdits *fe = g_hash_table_lookup(file_table, fname);
 
-		sci_start_undo_action(sci);
-		lsp_utils_apply_text_edits(sci, NULL, edits, FALSE);
-		sci_end_undo_action(sci);
+			if (!fe)
+			{
+				fe = lsp_text_edit_file_edits_new(fname, fname_locale);
+				g_hash_table_insert(file_table, fe->fname, fe);
+				g_ptr_array_add(file_edits, fe);
+			}
+			/* the same file can be edited several times by documentChanges,
+			 * each time relative to the previous edit */
+			g_ptr_array_add(fe->edits, edits);
+		}
+	}
+	else
+		g_ptr_array_free(edits, TRUE);
 
-		if (!doc)
-		{
-			gchar *contents = sci_get_contents(sci, -1);
+	g_free(fname);
+	g_free(fname_locale);
+}
 
-			g_file_set_contents(fname, contents, -1, NULL);
 
-#if 0
-			GVariant *node;
-			node = JSONRPC_MESSAGE_NEW (
-				"changes", "[", "{",
-					"uri", JSONRPC_MESSAGE_PUT_STRING(uri),
-					"type", JSONRPC_MESSAGE_PUT_INT32(2),  //changed
-				"}", "]"
-			);
+/* writes edits collected so far to the unopened files */
+static gboolean flush_file_edits(GPtrArray *file_edits, GHashTable *file_table)
+{
+	gboolean ret = TRUE;
+	LspFileEdits *fe;
+	guint i;
 
-			lsp_client_notify(srv, "workspace/didChangeWatchedFiles", node, NULL, NULL);
-			g_variant_unref(node);
-#endif
+	lsp_text_edit_apply_to_files(file_edits);
 
-			g_free(contents);
-			g_object_ref_sink(sci);
-			g_object_unref(sci);
+	foreach_ptr_array(fe, i, file_edits)
+	{
+		if (fe->error)
+		{
+			msgwin_status_add(_("Failed to apply edits to %s: %s"), fe->fname, fe->error->message);
+			ret = FALSE;
 		}
 	}
+
+	g_hash_table_remove_all(file_table);
+	g_ptr_array_set_size(file_edits, 0);
+
+	return ret;
+}
+
+
+static void get_resource_options(GVariant *op, gboolean *overwrite, gboolean *ignore_if_exists,
+	gboolean *recursive, gboolean *ignore_if_not_exists)
+{
+	GVariant *options = NULL;
+
+	*overwrite = *ignore_if_exists = *recursive = *ignore_if_not_exists = FALSE;
+
+	JSONRPC_MESSAGE_PARSE(op, "options", JSONRPC_MESSAGE_GET_VARIANT(&options));
+	if (!options)
+		return;
+
+	JSONRPC_MESSAGE_PARSE(options, "overwrite", JSONRPC_MESSAGE_GET_BOOLEAN(overwrite));
+	JSONRPC_MESSAGE_PARSE(options, "ignoreIfExists", JSONRPC_MESSAGE_GET_BOOLEAN(ignore_if_exists));
+	JSONRPC_MESSAGE_PARSE(options, "recursive", JSONRPC_MESSAGE_GET_BOOLEAN(recursive));
+	JSONRPC_MESSAGE_PARSE(options, "ignoreIfNotExists", JSONRPC_MESSAGE_GET_BOOLEAN(ignore_if_not_exists));
+
+	g_variant_unref(options);
+}
+
+
+static gboolean create_file(GVariant *op)
+{
+	gboolean overwrite, ignore_if_exists, recursive, ignore_if_not_exists;
+	const gchar *uri = NULL;
+	gchar *fname, *fname_locale;
+	GeanyDocument *doc;
+	gboolean ret = FALSE;
+
+	JSONRPC_MESSAGE_PARSE(op, "uri", JSONRPC_MESSAGE_GET_STRING(&uri));
+	if (!uri)
+		return FALSE;
+
+	get_resource_options(op, &overwrite, &ignore_if_exists, &recursive, &ignore_if_not_exists);
+
+	fname = lsp_utils_get_real_path_from_uri_utf8(uri);
+	fname_locale = lsp_utils_get_real_path_from_uri_locale(uri);
+	doc = fname ? document_find_by_filename(fname) : NULL;
+
+	if (!fname || !fname_locale)
+		ret = FALSE;
+	else if (g_file_test(fname_locale, G_FILE_TEST_EXISTS) && !overwrite)
+		ret = ignore_if_exists;  // overwrite wins over ignoreIfExists
+	else if (doc && doc->changed)
+		msgwin_status_add(_("Not overwriting %s because it has unsaved changes"), fname);
+	else
+	{
+		gchar *dirname = g_path_get_dirname(fname_locale);
+
+		ret = g_mkdir_with_parents(dirname, 0755) == 0 &&
+			g_file_set_contents(fname_locale, "", 0, NULL);
+
+		// the following edits are applied to the open document
+		if (ret && doc)
+			sci_set_text(doc->editor->sci, "");
+		else if (!ret)
+			msgwin_status_add(_("Failed to create %s"), fname);
+
+		g_free(dirname);
+	}
+
 	g_free(fname);
 	g_free(fname_locale);
+	return ret;
 }
 
 
-gboolean lsp_utils_apply_workspace_edit(GVariant *workspace_edit)
+static gboolean rename_file(GVariant *op)
 {
-	GVariant *changes = NULL;
+	gboolean overwrite, ignore_if_exists, recursive, ignore_if_not_exists;
+	const gchar *old_uri = NULL;
+	const gchar *new_uri = NULL;
+	gchar *old_fname, *old_fname_locale, *new_fname, *new_fname_locale;
+	GeanyDocument *doc;
 	gboolean ret = FALSE;
 
-	JSONRPC_MESSAGE_PARSE(workspace_edit,
-		"changes", JSONRPC_MESSAGE_GET_VARIANT(&changes)
-		);
+	JSONRPC_MESSAGE_PARSE(op,
+		"oldUri", JSONRPC_MESSAGE_GET_STRING(&old_uri),
+		"newUri", JSONRPC_MESSAGE_GET_STRING(&new_uri)
+	);
+	if (!old_uri || !new_uri)
+		return FALSE;
+
+	get_resource_options(op, &overwrite, &ignore_if_exists, &recursive, &ignore_if_not_exists);
 
-	if (changes && g_variant_is_of_type(changes, G_VARIANT_TYPE_DICTIONARY))
+	old_fname = lsp_utils_get_real_path_from_uri_utf8(old_uri);
+	old_fname_locale = lsp_utils_get_real_path_from_uri_locale(old_uri);
+	new_fname = lsp_utils_get_real_path_from_uri_utf8(new_uri);
+	new_fname_locale = lsp_utils_get_real_path_from_uri_locale(new_uri);
+	doc = old_fname ? document_find_by_filename(old_fname) : NULL;
+
+	if (!old_fname || !old_fname_locale || !new_fname || !new_fname_locale)
+		ret = FALSE;
+	else if (g_file_test(new_fname_locale, G_FILE_TEST_EXISTS) && !overwrite)
+		ret = ignore_if_exists;
+	else if (doc && doc->changed)
+		msgwin_status_add(_("Not renaming %s because it has unsaved changes"), old_fname);
+	else
 	{
-		GVariantIter iter;
-		GVariant *text_edits;
-		gchar *uri;
+		gchar *dirname = g_path_get_dirname(new_fname_locale);
+		gint pos = doc ? sci_get_current_position(doc->editor->sci) : 0;
 
-		g_variant_iter_init(&iter, changes);
-		while (g_variant_iter_loop(&iter, "{sv}", &uri, &text_edits))
+		g_mkdir_with_parents(dirname, 0755);
+
+		// the buffer matches the file on disk - reopen it under the new name
+		// instead of saving it
+		if (!doc)
+			ret = g_rename(old_fname_locale, new_fname_locale) == 0;
+		else if (document_close(doc))
 		{
-			GVariantIter iter2;
-			GPtrArray *edits;
+			ret = g_rename(old_fname_locale, new_fname_locale) == 0;
+			doc = document_open_file(ret ? new_fname_locale : old_fname_locale, FALSE, NULL, NULL);
+			if (doc)
+				sci_set_current_position(doc->editor->sci, pos, TRUE);
+		}
 
-			g_variant_iter_init(&iter2, text_edits);
+		if (!ret)
+			msgwin_status_add(_("Failed to rename %s"), old_fname);
 
-			edits = lsp_utils_parse_text_edits(&iter2);
-			apply_edits_in_file(uri,  edits);
+		g_free(dirname);
+	}
 
-			g_ptr_array_free(edits, TRUE);
+	g_free(old_fname);
+	g_free(old_fname_locale);
+	g_free(new_fname);
+	g_free(new_fname_locale);
+	return ret;
+}
+
+
+static gboolean remove_path(const gchar *locale_path, gboolean recursive)
+{
+	if (recursive && g_file_test(locale_path, G_FILE_TEST_IS_DIR) &&
+		!g_file_test(locale_path, G_FILE_TEST_IS_SYMLINK))
+	{
+		GDir *dir = g_dir_open(locale_path, 0, NULL);
+		const gchar *name;
+		gboolean ret = dir != NULL;
+
+		while (ret && (name = g_dir_read_name(dir)))
+		{
+			gchar *child = g_build_filename(locale_path, name, NULL);
+			ret = remove_path(child, TRUE);
+			g_free(child);
 		}
 
-		ret = TRUE;
+		if (dir)
+			g_dir_close(dir);
+		if (!ret)
+			return FALSE;
 	}
 
-	if (changes)
-		g_variant_unref(changes);
+	return g_remove(locale_path) == 0;
+}
 
-	if (!ret)
+
+/* closes documents of the file or inside the directory, the user may refuse
+ * to close a modified document */
+static gboolean close_documents_under(const gchar *locale_path)
+{
+	gsize len = strlen(locale_path);
+	guint i;
+
+	foreach_document(i)
 	{
-		GVariantIter *iter = NULL;
-		GVariant *document_chages = NULL;
+		GeanyDocument *doc = documents[i];
 
-		JSONRPC_MESSAGE_PARSE(workspace_edit,
-			"documentChanges", JSONRPC_MESSAGE_GET_ITER(&iter)
-			);
+		if (!doc->real_path || strncmp(doc->real_path, locale_path, len) != 0 ||
+			(doc->real_path[len] != '\0' && doc->real_path[len] != G_DIR_SEPARATOR))
+			continue;
+
+		if (!document_close(doc))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+static gboolean delete_file(GVariant *op)
+{
+	gboolean overwrite, ignore_if_exists, recursive, ignore_if_not_exists;
+	const gchar *uri = NULL;
+	gchar *fname, *fname_locale;
+	gboolean ret = FALSE;
+
+	JSONRPC_MESSAGE_PARSE(op, "uri", JSONRPC_MESSAGE_GET_STRING(&uri));
+	if (!uri)
+		return FALSE;
+
+	get_resource_options(op, &overwrite, &ignore_if_exists, &recursive, &ignore_if_not_exists);
+
+	fname = lsp_utils_get_real_path_from_uri_utf8(uri);
+	fname_locale = lsp_utils_get_real_path_from_uri_locale(uri);
+
+	if (!fname || !fname_locale)
+		ret = FALSE;
+	else if (!g_file_test(fname_locale, G_FILE_TEST_EXISTS))
+		ret = ignore_if_not_exists;
+	else if (recursive && g_file_test(fname_locale, G_FILE_TEST_IS_DIR) &&
+		!dialogs_show_question(_("The language server wants to delete the directory\n%s\nwith all its contents. Continue?"), fname))
+		msgwin_status_add(_("Deleting %s cancelled"), fname);
+	else
+	{
+		if (close_documents_under(fname_locale))
+			ret = remove_path(fname_locale, recursive);
+
+		if (!ret)
+			msgwin_status_add(_("Failed to delete %s"), fname);
+	}
+
+	g_free(fname);
+	g_free(fname_locale);
+	return ret;
+}
+
+
+/* the server computed the edits against a specific version of the document,
+ * refuse them when the document changed in the meantime */
+static gboolean document_versions_match(GVariant *document_changes)
+{
+	GVariant *change;
+	GVariantIter iter;
+	gboolean ret = TRUE;
+
+	g_variant_iter_init(&iter, document_changes);
+	while (ret && (change = g_variant_iter_next_value(&iter)))
+	{
+		GVariant *text_document = NULL;
+		GVariant *unboxed = g_variant_get_variant(change);
 
-		while (iter && g_variant_iter_loop(iter, "v", &document_chages))
+		JSONRPC_MESSAGE_PARSE(unboxed, "textDocument", JSONRPC_MESSAGE_GET_VARIANT(&text_document));
+
+		if (text_document)
+		{
+			const gchar *uri = NULL;
+			gint64 version = -1;
+			GeanyDocument *doc = NULL;
+
+			// version is null for documents not open on the server
+			JSONRPC_MESSAGE_PARSE(text_document, "uri", JSONRPC_MESSAGE_GET_STRING(&uri));
+			JSONRPC_MESSAGE_PARSE(text_document, "version", JSONRPC_MESSAGE_GET_INT64(&version));
+
+			if (uri && version >= 0)
+			{
+				gchar *fname = lsp_utils_get_real_path_from_uri_utf8(uri);
+
+				if (fname)
+					doc = document_find_by_filename(fname);
+				if (doc && lsp_sync_get_doc_version(doc) != version)
+				{
+					msgwin_status_add(_("Edits of %s refused because the document has changed"), fname);
+					ret = FALSE;
+				}
+				g_free(fname);
+			}
+
+			g_variant_unref(text_document);
+		}
+
+		g_variant_unref(unboxed);
+		g_variant_unref(change);
+	}
+
+	return ret;
+}
+
+
+static gboolean apply_document_changes(GVariant *document_changes, GPtrArray *file_edits,
+	GHashTable *file_table)
+{
+	GVariant *change;
+	GVariantIter iter;
+	gboolean ret = TRUE;
+
+	if (!document_versions_match(document_changes))
+		return FALSE;
+
+	g_variant_iter_init(&iter, document_changes);
+	while (ret && (change = g_variant_iter_next_value(&iter)))
+	{
+		GVariant *unboxed = g_variant_get_variant(change);
+		const gchar *kind = NULL;
+
+		JSONRPC_MESSAGE_PARSE(unboxed, "kind", JSONRPC_MESSAGE_GET_STRING(&kind));
+
+		if (kind)
+		{
+			// resource operations may depend on the previous edits being written
+			ret = flush_file_edits(file_edits, file_table);
+
+			if (ret && g_strcmp0(kind, "create") == 0)
+				ret = create_file(unboxed);
+			else if (ret && g_strcmp0(kind, "rename") == 0)
+				ret = rename_file(unboxed);
+			else if (ret && g_strcmp0(kind, "delete") == 0)
+				ret = delete_file(unboxed);
+		}
+		else
 		{
 			const gchar *uri = NULL;
 			GVariantIter *iter2 = NULL;
 
-			//TODO: support CreateFile, RenameFile, DeleteFile
-			JSONRPC_MESSAGE_PARSE(document_chages,
+			JSONRPC_MESSAGE_PARSE(unboxed,
 				"textDocument", "{",
 					"uri", JSONRPC_MESSAGE_GET_STRING(&uri),
 				"}",
@@ -589,18 +865,74 @@ gboolean lsp_utils_apply_workspace_edit(GVariant *workspace_edit)
 			{
 				GPtrArray *edits = lsp_utils_parse_text_edits(iter2);
 
-				apply_edits_in_file(uri, edits);
-				ret = TRUE;
+				add_edits_in_file(uri, edits, file_edits, file_table);
+			}
 
-				g_ptr_array_free(edits, TRUE);
+			if (iter2)
 				g_variant_iter_free(iter2);
-			}
 		}
 
-		if (iter)
-			g_variant_iter_free(iter);
+		g_variant_unref(unboxed);
+		g_variant_unref(change);
+	}
+
+	return ret;
+}
+
+
+gboolean lsp_utils_apply_workspace_edit(GVariant *workspace_edit)
+{
+	GVariant *document_changes = NULL;
+	GVariant *changes = NULL;
+	gboolean ret = FALSE;
+	GPtrArray *file_edits = g_ptr_array_new_full(0, (GDestroyNotify)lsp_text_edit_file_edits_free);
+	GHashTable *file_table = g_hash_table_new(g_str_hash, g_str_equal);
+
+	// documentChanges are preferred over changes when present
+	JSONRPC_MESSAGE_PARSE(workspace_edit,
+		"documentChanges", JSONRPC_MESSAGE_GET_VARIANT(&document_changes)
+		);
+
+	if (document_changes && g_variant_is_of_type(document_changes, G_VARIANT_TYPE("av")))
+		ret = apply_document_changes(document_changes, file_edits, file_table);
+	else
+	{
+		JSONRPC_MESSAGE_PARSE(workspace_edit,
+			"changes", JSONRPC_MESSAGE_GET_VARIANT(&changes)
+			);
+
+		if (changes && g_variant_is_of_type(changes, G_VARIANT_TYPE_DICTIONARY))
+		{
+			GVariantIter iter;
+			GVariant *text_edits;
+			gchar *uri;
+
+			g_variant_iter_init(&iter, changes);
+			while (g_variant_iter_loop(&iter, "{sv}", &uri, &text_edits))
+			{
+				GVariantIter iter2;
+				GPtrArray *edits;
+
+				g_variant_iter_init(&iter2, text_edits);
+
+				edits = lsp_utils_parse_text_edits(&iter2);
+				add_edits_in_file(uri, edits, file_edits, file_table);
+			}
+
+			ret = TRUE;
+		}
 	}
 
+	if (!flush_file_edits(file_edits, file_table))
+		ret = FALSE;
+
+	if (changes)
+		g_variant_unref(changes);
+	if (document_changes)
+		g_variant_unref(document_changes);
+	g_hash_table_destroy(file_table);
+	g_ptr_array_free(file_edits, TRUE);
+
 	return ret;
 }
 
@@ -699,6 +1031,40 @@ static gchar *utf8_strdown(const gchar *str)
 }
 
 
+/* normalized and casefolded string used for case-insensitive matching */
+gchar *lsp_utils_normalize_casefold(const gchar *str)
+{
+	gchar *normalized = g_utf8_normalize(str, -1, G_NORMALIZE_ALL);
+	gchar *ret;
+
+	if (!normalized)
+		return g_strdup("");
+
+	ret = g_utf8_casefold(normalized, -1);
+	g_free(normalized);
+	return ret;
+}
+
+
+/* Returns the length of the first line of @str including its terminator,
+ * which is any of \n, \r and \r\n as LSP allows, or 0 when @str contains
+ * no terminator. */
+gsize lsp_utils_skip_line(const gchar *str, gsize len)
+{
+	gsize i;
+
+	for (i = 0; i < len; i++)
+	{
+		if (str[i] == '\n')
+			return i + 1;
+		if (str[i] == '\r')
+			return i + 1 < len && str[i + 1] == '\n' ? i + 2 : i + 1;
+	}
+
+	return 0;
+}
+
+
 gpointer lsp_utils_lowercase_cmp(LspUtilsCmpFn cmp, const gchar *s1, const gchar *s2)
 {
 	gchar *tmp1, *tmp2;
@@ -786,40 +1152,6 @@ GVariant *lsp_utils_parse_json_file_as_variant(const gchar *utf8_fname, const gc
 }
 
 
-ScintillaObject *lsp_utils_new_sci_from_file(const gchar *utf8_fname)
-{
-	ScintillaObject *sci;
-	gchar *file_contents;
-	gchar *fname;
-	gboolean success;
-
-	if (!utf8_fname)
-		return NULL;
-
-	fname = utils_get_locale_from_utf8(utf8_fname);
-	if (!fname)
-		return NULL;
-
-	success = g_file_get_contents(fname, &file_contents, NULL, NULL);
-	g_free(fname);
-
-	if (!success)
-		return NULL;
-
-	sci = SCINTILLA(scintilla_object_new());
-
-	gtk_widget_set_direction(GTK_WIDGET(sci), GTK_TEXT_DIR_LTR);
-
-	SSM(sci, SCI_SETCODEPAGE, (uptr_t) SC_CP_UTF8, 0);
-	SSM(sci, SCI_SETWRAPMODE, SC_WRAP_NONE, 0);
-
-	sci_set_text(sci, file_contents);
-
-	g_free(file_contents);
-	return sci;
-}
-
-
 gchar *lsp_utils_get_current_iden(GeanyDocument *doc, gint current_pos, const gchar *wordchars)
 {
 	ScintillaObject *sci = doc->editor->sci;
@@ -990,13 +1322,23 @@ static gboolean content_matches_pattern(const gchar *dirname, gchar **patterns)
 
 
 gchar *lsp_utils_find_project_root(GeanyDocument *doc, LspServerConfig *cfg)
+{
+	if (!doc)
+		return NULL;
+
+	return lsp_utils_find_project_root_for_file(doc->real_path, cfg);
+}
+
+
+/* like lsp_utils_find_project_root() for a file which may not be open */
+gchar *lsp_utils_find_project_root_for_file(const gchar *locale_real_path, LspServerConfig *cfg)
 {
 	gchar *dirname;
 
-	if (!doc || !cfg || !cfg->project_root_marker_patterns || !doc->real_path)
+	if (!locale_real_path || !cfg || !cfg->project_root_marker_patterns)
 		return NULL;
 
-	dirname = g_path_get_dirname(doc->real_path);
+	dirname = g_path_get_dirname(locale_real_path);
 
 	while (dirname)
 	{
@@ -112,12 +112,12 @@ gboolean lsp_utils_apply_workspace_edit(GVariant *workspace_edit);
 gboolean lsp_utils_wrap_string(gchar *string, gint wrapstart);
 
 gpointer lsp_utils_lowercase_cmp(LspUtilsCmpFn cmp, const gchar *s1, const gchar *s2);
+gchar *lsp_utils_normalize_casefold(const gchar *str);
+gsize lsp_utils_skip_line(const gchar *str, gsize len);
 
 GVariant *lsp_utils_parse_json_file_as_variant(const gchar *utf8_fname, const gchar *fallback_json);
 JsonNode *lsp_utils_parse_json_file(const gchar *utf8_fname, const gchar *fallback_json);
 
-ScintillaObject *lsp_utils_new_sci_from_file(const gchar *utf8_fname);
-
 gchar *lsp_utils_get_current_iden(GeanyDocument *doc, gint current_pos, const gchar *wordchars);
 
 gint lsp_utils_set_indicator_style(ScintillaObject *sci, const gchar *style_str);
@@ -127,6 +127,7 @@ gchar *lsp_utils_get_relative_path(const gchar *utf8_parent, const gchar *utf8_d
 void lsp_utils_save_all_docs(void);
 
 gchar *lsp_utils_find_project_root(GeanyDocument *doc, LspServerConfig *cfg);
+gchar *lsp_utils_find_project_root_for_file(const gchar *locale_real_path, LspServerConfig *cfg);
 
 gchar *lsp_utils_process_snippet(const gchar *snippet, GSList **positions);
 